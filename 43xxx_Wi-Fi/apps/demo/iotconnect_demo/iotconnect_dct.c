@@ -0,0 +1,11 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#include "wiced_framework.h"
+#include "iotconnect_dct.h"
+
+DEFINE_APP_DCT(iotconnect_demo_dct_t) = {
+        .sr_cache = {0},
+};
@@ -0,0 +1,23 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define IOTCONNECT_DEMO_SR_CACHE_SIZE       1024
+
+// Application DCT section. Regions in here are handed to the SDK as non-volatile storage.
+typedef struct {
+    uint8_t sr_cache[IOTCONNECT_DEMO_SR_CACHE_SIZE];
+} iotconnect_demo_dct_t;
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
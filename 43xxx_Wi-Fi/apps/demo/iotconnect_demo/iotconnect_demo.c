@@ -36,10 +36,12 @@
  */
 
 #include "wiced.h"
+#include <stddef.h>
 #include <time.h>
 #include <sntp.h>
 #include <mqtt_common.h>
 #include "iotconnect_client_config.h"
+#include "iotconnect_dct.h"
 
 #include "iotconnect_lib.h"
 #include "iotconnect_telemetry.h"
@@ -51,6 +53,24 @@
 
 static wiced_result_t get_credentials_from_resources(wiced_mqtt_security_t *s);
 
+/*
+ * Non-volatile storage for the SDK backed by the application DCT. ctx holds the region offset within the DCT.
+ */
+static wiced_result_t dct_storage_read(void *ctx, uint32_t offset, void *data, uint32_t len) {
+    return wiced_dct_read_with_copy(data, DCT_APP_SECTION, (uint32_t) (uintptr_t) ctx + offset, len);
+}
+
+static wiced_result_t dct_storage_write(void *ctx, uint32_t offset, const void *data, uint32_t len) {
+    return wiced_dct_write(data, DCT_APP_SECTION, (uint32_t) (uintptr_t) ctx + offset, len);
+}
+
+static IotconnectNvStorage sr_cache_storage = {
+        .read = dct_storage_read,
+        .write = dct_storage_write,
+        .ctx = (void *) offsetof(iotconnect_demo_dct_t, sr_cache),
+        .size = IOTCONNECT_DEMO_SR_CACHE_SIZE
+};
+
 /*
  * time() function implementation, required for IotConnect C Library
  */
@@ -68,7 +88,7 @@ static void on_command(IotclEventData data) {
     }
     const char *ack = iotcl_create_ack_string_and_destroy_event(data, false, "Not implemented");
     if (NULL != ack) {
-        iotconnect_sdk_send_packet(ack);
+        iotconnect_sdk_send_ack(ack);
         WPRINT_APP_INFO(("Sent CMD ack: %s\n", ack));
         free((void *) ack);
     } else {
@@ -99,7 +119,7 @@ static void on_ota(IotclEventData data) {
     const char *ack = iotcl_create_ack_string_and_destroy_event(data, success, message);
     if (NULL != ack) {
         WPRINT_APP_INFO(("Sent OTA ack: %s\n", ack));
-        iotconnect_sdk_send_packet(ack);
+        iotconnect_sdk_send_ack(ack);
         free((void *) ack);
     }
 }
@@ -118,6 +138,15 @@ static void on_connection_status(IotconnectConnectionStatus status, void *data)
             WPRINT_APP_INFO(("Packet ID %u published\n", *data_ptr));
         }
             break;
+        case IOTC_INIT_DISCOVERY:
+        case IOTC_INIT_CONNECTING:
+            break;
+        case IOTC_INIT_DONE:
+            WPRINT_APP_INFO(("IoTConnect SDK initialized\n"));
+            break;
+        case IOTC_INIT_FAILED:
+            WPRINT_APP_ERROR(("IoTConnect SDK init failed\n"));
+            break;
         case MQTT_FAILED:
         default:
             WPRINT_APP_ERROR(("IoTConnect MQTT ERROR\n"));
@@ -126,15 +155,19 @@ static void on_connection_status(IotconnectConnectionStatus status, void *data)
 }
 
 static void publish_telemetry() {
-    IotclMessageHandle msg = iotcl_telemetry_create(iotconnect_sdk_get_lib_config());
+    IotclMessageHandle msg = iotconnect_sdk_telemetry_create();
+    if (!msg) {
+        return;
+    }
 
     iotcl_telemetry_set_string(msg, "version", MAIN_APP_VERSION);
     iotcl_telemetry_set_number(msg, "cpu", 33);
 
     const char *str = iotcl_create_serialized_string(msg, false);
     iotcl_telemetry_destroy(msg);
-    wiced_mqtt_msgid_t pktId = iotconnect_sdk_send_packet(str);
-    WPRINT_APP_INFO(("Sending packet ID %u: %s\n", pktId, str));
+    if (WICED_SUCCESS == iotconnect_sdk_send_packet(str)) {
+        WPRINT_APP_INFO(("Sending: %s\n", str));
+    }
     iotcl_destroy_serialized(str);
 }
 
@@ -182,24 +215,36 @@ void application_start(void) {
     config->ota_cb = on_ota;
     config->status_cb = on_connection_status;
 
+    // skip discovery on the next boot if broker parameters are still valid
+    config->sr_cache_storage = &sr_cache_storage;
+
+    // keep up to 4KB of telemetry while the connection is down
+    config->queue_size = 4096;
+    config->queue_drop_policy = IOTC_QUEUE_DROP_OLDEST;
+
+    // send every 20 seconds on a good link and back off to up to 5 minutes on a congested one
+    config->telemetry_interval_min_ms = 20000;
+    config->telemetry_interval_max_ms = 5 * 60 * 1000;
+
     ret = iotconnect_sdk_init();
     if (WICED_SUCCESS != ret) {
         WPRINT_APP_ERROR(("Failed to initialize the SDK\n"));
         return;
     }
 
+    // The SDK reconnects on its own if the connection drops. Messages are queued in the meantime.
     int i = 0;
-    while (ret == iotconnect_sdk_is_connected() && i < 10) {
+    while (i < 10) {
 
         publish_telemetry();
 
-        wiced_rtos_delay_milliseconds(20000);
+        wiced_rtos_delay_milliseconds(iotconnect_sdk_get_telemetry_interval());
         i++;
 
     }
     iotconnect_sdk_disconnect();
 
-    /* Free security resources, only needed at initialization */
+    /* Free security resources, only needed while connected */
     resource_free_readonly_buffer(&resources_apps_DIR_iotconnect_demo_DIR_rootca_cer, config->security.ca_cert);
     resource_free_readonly_buffer(&resources_apps_DIR_iotconnect_demo_DIR_client_cer, config->security.cert);
     resource_free_readonly_buffer(&resources_apps_DIR_iotconnect_demo_DIR_privkey_cer, config->security.key);
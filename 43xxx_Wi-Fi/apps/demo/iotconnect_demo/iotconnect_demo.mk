@@ -49,6 +49,7 @@ $(NAME)_COMPONENTS := \
 
 
 WIFI_CONFIG_DCT_H := wifi_config_dct.h
+APPLICATION_DCT := iotconnect_dct.c
 
 $(NAME)_RESOURCES  := apps/iotconnect_demo/rootca.cer \
 					  apps/iotconnect_demo/client.cer \
@@ -231,6 +231,11 @@ wiced_result_t http_client_connect( http_client_t* client, const wiced_ip_addres
             }
         }
 
+        if ( client->tls_session != NULL )
+        {
+            memcpy( &client->tls_context->session, client->tls_session, sizeof( wiced_tls_session_t ) );
+        }
+
         wiced_tcp_enable_tls( &client->socket, (void*)client->tls_context );
     }
 
@@ -240,6 +245,11 @@ wiced_result_t http_client_connect( http_client_t* client, const wiced_ip_addres
         return result;
     }
 
+    if ( security == HTTP_USE_TLS && client->tls_session != NULL )
+    {
+        memcpy( client->tls_session, &client->tls_context->session, sizeof( wiced_tls_session_t ) );
+    }
+
     return result;
 }
 
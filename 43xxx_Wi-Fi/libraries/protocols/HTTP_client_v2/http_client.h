@@ -110,6 +110,7 @@ typedef struct
     wiced_worker_thread_t thread;             /* HTTP worker thread to process upstream HTTP frames */
     http_client_configuration_info_t *config; /* HTTP client configuration settings (optional) */
     uint8_t*              peer_cn;            /* Peer Common Name (optional) */
+    wiced_tls_session_t*  tls_session;        /* TLS session to resume, updated with the negotiated session on connect (optional) */
     void*                 user_data;          /* Reserved */
 } http_client_t;
 
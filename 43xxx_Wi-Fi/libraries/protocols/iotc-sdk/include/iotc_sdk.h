@@ -3,6 +3,7 @@
 #include <wiced.h>
 #include <mqtt_common.h>
 #include "iotconnect_lib.h"
+#include "iotconnect_discovery.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -14,22 +15,249 @@ typedef enum {
     MQTT_DISCONNECTED,
     MQTT_PUBLISHED,
     MQTT_FAILED,
-    // TODO: Sync statuses etc.
+    // progress of iotconnect_sdk_init_async
+    IOTC_INIT_DISCOVERY, // obtaining broker parameters from the cache or by running discovery
+    IOTC_INIT_CONNECTING, // connecting to the broker
+    IOTC_INIT_DONE, // init completed. Queued messages are being sent
+    IOTC_INIT_FAILED, // event_data points to the wiced_result_t of the failed step
 } IotconnectConnectionStatus;
 
 typedef void (*IotConnectStatusCallback)(IotconnectConnectionStatus status, void* event_data);
 
+// Non-volatile storage region provided by the application (DCT section, external flash, a file on a host etc.).
+// Offsets are relative to the start of the region. Functions should return WICED_SUCCESS on success.
+typedef struct {
+    wiced_result_t (*read)(void *ctx, uint32_t offset, void *data, uint32_t len);
+    wiced_result_t (*write)(void *ctx, uint32_t offset, const void *data, uint32_t len);
+    void *ctx; // passed as the first argument of read and write
+    uint32_t size; // size of the region in bytes
+} IotconnectNvStorage;
+
+typedef enum {
+    IOTC_QUEUE_DROP_NEWEST = 0, // reject new messages when the queue is full
+    IOTC_QUEUE_DROP_OLDEST // discard the oldest queued messages to make room for new ones
+} IotconnectQueueDropPolicy;
+
+typedef struct {
+    uint32_t depth; // number of messages currently queued, including spilled ones
+    uint32_t spilled; // number of messages currently in the spill storage
+    uint32_t queued; // total number of messages accepted into the queue
+    uint32_t sent; // total number of queued messages that were sent
+    uint32_t dropped_overflow; // messages dropped because the queue was full
+    uint32_t dropped_expired; // messages dropped because they expired before they could be sent
+} IotconnectQueueStats;
+
+typedef enum {
+    IOTC_PRIORITY_NORMAL = 0, // telemetry
+    IOTC_PRIORITY_HIGH, // command and OTA acks, control messages. Sent ahead of all normal priority messages
+    IOTC_PRIORITY_NUM
+} IotconnectSendPriority;
+
+// Per priority class. Queue waits are measured from queueing until the message is handed to the network.
+typedef struct {
+    uint32_t depth; // messages currently queued
+    uint32_t sent_direct; // messages sent without being queued
+    uint32_t sent_queued; // messages sent from the queue
+    uint32_t dropped; // messages dropped because the queue was full or because they expired
+    uint32_t max_wait_ms;
+    uint32_t total_wait_ms; // divide by sent_queued to get the average
+} IotconnectPriorityStats;
+
+typedef enum {
+    IOTC_RATE_LIMIT_DROP = 0, // reject messages over the limit
+    IOTC_RATE_LIMIT_BLOCK, // wait for the budget, up to rate_limit_block_timeout_ms
+    IOTC_RATE_LIMIT_AGGREGATE // merge telemetry records over the limit into a message sent once the budget allows
+} IotconnectRateLimitPolicy;
+
+typedef struct {
+    uint32_t allowed; // messages that were within the budget, including coalesced messages
+    uint32_t delayed; // messages that waited for the budget (IOTC_RATE_LIMIT_BLOCK)
+    uint32_t total_delay_ms;
+    uint32_t timed_out; // messages that could not be sent within rate_limit_block_timeout_ms
+    uint32_t dropped; // messages rejected over the limit
+    uint32_t aggregated; // records over the limit that were merged into a later message
+    uint32_t tokens; // messages that can be sent right now
+} IotconnectRateLimitStats;
+
+typedef enum {
+    IOTC_INBOUND_DROP_NEWEST = 0, // drop messages that arrive while the inbound queue is full
+    IOTC_INBOUND_BLOCK // hold the MQTT thread up to inbound_block_timeout_ms, so that the broker slows down
+} IotconnectInboundOverflowPolicy;
+
+typedef struct {
+    uint32_t disconnects; // connection losses that were not requested by the application
+    uint32_t attempts; // reconnect attempts
+    uint32_t reconnects; // successful reconnects
+    uint32_t last_latency_ms; // time from the last connection loss until the connection was restored
+    uint32_t max_latency_ms;
+    uint32_t total_latency_ms; // divide by reconnects to get the average
+    uint32_t sessions_resumed; // connects where the broker still had the session and resubscribing was skipped
+} IotconnectReconnectStats;
+
+typedef struct {
+    uint32_t full_handshakes;
+    uint32_t abbreviated_handshakes; // handshakes that resumed a cached TLS session
+} IotconnectTlsStats;
+
+typedef struct {
+    uint32_t interval_secs; // keepalive of the current connection
+    uint32_t nat_timeout_secs; // interval at which an idle link was dropped. 0 if not learned yet
+    uint32_t idle_periods; // keepalive periods without traffic other than pings
+} IotconnectKeepaliveStats;
+
+typedef struct {
+    uint32_t records; // messages added for coalescing
+    uint32_t records_merged; // messages that were appended to another message instead of being published
+    uint32_t batches; // coalesced messages passed on for publishing
+    uint32_t records_dropped; // records in batches that could neither be published nor queued
+} IotconnectCoalesceStats;
+
+typedef struct {
+    uint32_t attempts; // messages that were large enough to be compressed
+    uint32_t compressed; // messages that were sent compressed
+    uint32_t bytes_in; // size of the compressed messages before compression
+    uint32_t bytes_out; // and after. bytes_in - bytes_out were saved
+    uint32_t total_time_us; // time spent compressing. Divide by attempts to get the cost per message
+} IotconnectCompressionStats;
+
+typedef struct {
+    uint32_t received; // devicebound messages passed on for IoTConnect processing
+    uint32_t duplicates; // QoS1 redeliveries with an already seen ackId that were dropped before processing
+    uint32_t dropped; // messages dropped because the inbound queue was full
+    uint32_t max_queue_used; // peak inbound queue usage in bytes
+} IotconnectInboundStats;
+
+typedef struct {
+    uint32_t enqueued; // messages handed to the publisher thread
+    uint32_t rejected; // messages rejected because the publisher queue was full
+    uint32_t contended; // slot claims retried because another thread claimed the same slot first
+    uint32_t depth;
+    uint32_t max_depth;
+    uint32_t processed;
+    uint32_t max_latency_ms; // time from the hand-off until the publisher thread picked the message up
+    uint32_t total_latency_ms; // divide by processed to get the average
+} IotconnectPublisherStats;
+
+// Upper bounds (ms) of the PUBLISH->PUBACK latency histogram buckets. The last bucket counts everything above.
+#define IOTC_SDK_PUBACK_LATENCY_BUCKETS {50, 100, 200, 500, 1000, 2000, 5000}
+#define IOTC_SDK_PUBACK_LATENCY_NUM_BUCKETS 8
+
+typedef struct {
+    uint32_t published; // QoS1 messages handed to the network, excluding retransmissions
+    uint32_t published_qos0; // QoS0 messages handed to the network. These are not tracked further
+    uint32_t acknowledged;
+    uint32_t retransmits;
+    uint32_t failed; // not acknowledged after all retransmits, or dropped on disconnect
+    uint32_t window_full; // publishes rejected because the in-flight window was full
+    uint32_t inflight; // currently waiting for PUBACK
+    uint32_t min_latency_ms;
+    uint32_t max_latency_ms;
+    uint32_t total_latency_ms; // divide by acknowledged to get the average
+    uint32_t latency_histogram[IOTC_SDK_PUBACK_LATENCY_NUM_BUCKETS];
+} IotconnectPublishStats;
+
+// Called whenever the adaptive telemetry interval changes. Must not block.
+typedef void (*IotconnectIntervalCallback)(uint32_t interval_ms, void *ctx);
+
+// Called once the message is acknowledged by the broker (WICED_SUCCESS), or when it is given up on.
+// latency_ms is the time from the first transmission until the PUBACK. Must not block.
+typedef void (*IotconnectPublishCallback)(wiced_result_t result, uint32_t latency_ms, void *ctx);
+
+// Receives raw inbound messages for a registered topic filter. Neither topic nor data are NUL terminated.
+typedef void (*IotconnectTopicHandler)(const uint8_t *topic, size_t topic_len, const uint8_t *data, size_t len,
+                                       void *ctx);
+
+// Per-message options for iotconnect_sdk_send_packet_ex. Zero-initialize to get the defaults.
+typedef struct {
+    uint32_t expiry_ms; // Discard the message if it can't be sent within this time. 0: Use queue_expiry_ms
+    IotconnectPublishCallback publish_cb; // optional. At QoS0, called as soon as the message is sent
+    void *publish_ctx; // passed to publish_cb
+    bool qos0; // Publish at QoS0: no PUBACK, in-flight tracking or retransmission. Default: QoS1
+    IotconnectSendPriority priority; // Default: IOTC_PRIORITY_NORMAL
+} IotconnectSendOptions;
+
 typedef struct {
     /* IoTConnect device connection parameters */
     char *env;    // Environment name. Contact your representative for details.
     char *cpid;   // Settings -> Company Profile.
     char *duid;   // Device ID.
-    wiced_mqtt_security_t security; // mqtt security structure with ca_cert, client cert and private key can be freed once connected
+    // mqtt security structure with ca_cert, client cert and private key. Kept by the SDK, as reconnects need it
+    wiced_mqtt_security_t security;
 
     /* timing settings */
     uint32_t mqtt_timeout_ms; // Timeout for most operations. 2x timeout for connect and subscribe. Default: 10000
     int num_discovery_tires; // How many times to retry discovery Default: 3
 
+    /* sync response cache */
+    IotconnectNvStorage *sr_cache_storage; // If set, discovery results are cached here and reused on next boot
+    uint32_t sr_cache_ttl_secs; // How long a cached sync response is trusted. Default: 86400 (one day)
+    bool sr_revalidate; // Connect with the cached sync response regardless of its age, then run discovery in the
+                        // background and reconnect only if the broker parameters changed. Default: false
+
+    /* TLS session cache */
+    IotconnectNvStorage *tls_session_storage; // If set, TLS sessions are kept here and resumed after a reboot.
+                                              // Holds session secrets, so it must not be readable off the device
+
+    /* outbound queue - holds messages while the connection is down */
+    uint32_t queue_size; // Size of the RAM queue in bytes. Default: 0 (messages are dropped while disconnected)
+    IotconnectQueueDropPolicy queue_drop_policy; // What to do when the queue is full. Default: IOTC_QUEUE_DROP_NEWEST
+    uint32_t queue_expiry_ms; // Default expiry for queued messages. Default: 0 (never expire)
+    IotconnectNvStorage *queue_spill_storage; // If set, messages that don't fit into RAM are spilled here
+    uint32_t queue_priority_size; // Size of the separate RAM queue for high priority messages. Default: 1024
+
+    /* publish coalescing - merges telemetry records into one message */
+    uint32_t coalesce_size; // Flush when the merged message reaches this size in bytes. Default: 0 (disabled)
+    uint32_t coalesce_delay_ms; // Flush this long after the first record was added. Default: 1000
+
+    /* rate limiting - keeps normal priority messages within the per-device message quota of the hub */
+    uint32_t rate_limit_per_min; // Average messages per minute. Default: 0 (no limit)
+    uint32_t rate_limit_burst; // Messages that can be sent back to back after an idle period.
+                               // Default: 10 seconds worth of rate_limit_per_min, at least 1
+    IotconnectRateLimitPolicy rate_limit_policy; // What to do over the limit. Default: IOTC_RATE_LIMIT_DROP
+    uint32_t rate_limit_block_timeout_ms; // Longest wait with IOTC_RATE_LIMIT_BLOCK. Default: 10000
+
+    /* compression */
+    uint32_t compress_min_size; // Compress messages of at least this size. The publish topic is marked
+                                // with IOTC_SDK_COMPRESSED_TOPIC_PROPERTY. Default: 0 (disabled)
+
+    /* QoS1 in-flight tracking */
+    uint32_t publish_window; // Max messages waiting for PUBACK. Default and max: IOTC_SDK_MAX_INFLIGHT
+                             // One slot is kept for high priority messages if the window is larger than 1
+    uint32_t puback_timeout_ms; // Retransmit if PUBACK is not received in this time. Default: mqtt_timeout_ms
+    int max_retransmits; // Retransmissions before giving up on a message. -1 to disable. Default: 2
+
+    /* keepalive */
+    uint16_t keepalive_secs; // MQTT keepalive interval. Default: 30
+    uint16_t keepalive_probe_max_secs; // If set, reconnects request longer intervals, up to this value, to learn
+                                       // the NAT idle timeout. WICED only sets the interval at connect, so a link
+                                       // that never drops keeps the interval it connected with. Default: 0
+
+    /* adaptive telemetry interval - lengthened while the link is congested, shortened while it is healthy */
+    uint32_t telemetry_interval_min_ms; // Shortest interval. Default: 5000
+    uint32_t telemetry_interval_max_ms; // Longest interval. Default: 0 (the interval is not adapted)
+    IotconnectIntervalCallback interval_cb; // optional
+    void *interval_ctx; // passed to interval_cb
+
+    /* inbound - messages are handed from the MQTT thread to the SDK thread, which runs the callbacks */
+    uint32_t inbound_queue_size; // Bytes of queued inbound messages, rounded down to a power of two. Default: 4096
+                                 // This also caps the message size: a message takes 8 bytes plus its topic and
+                                 // payload, rounded up to 4. Larger messages are dropped and counted as dropped.
+                                 // Init fails if the queue can't be allocated.
+    IotconnectInboundOverflowPolicy inbound_overflow_policy; // Default: IOTC_INBOUND_DROP_NEWEST
+    uint32_t inbound_block_timeout_ms; // Longest wait with IOTC_INBOUND_BLOCK. Default: 1000
+
+    /* threading */
+    uint32_t publisher_queue_len; // Messages waiting for the publisher thread, which does all publishing, so that
+                                  // any thread can send. Rounded down to a power of two. Default: 0 (disabled)
+    uint32_t publisher_slot_size; // Messages up to this size are copied into memory allocated with the publisher
+                                  // queue. Larger ones are copied to the heap. Default: 256
+    bool poll_mode; // Callbacks, timers, queue drains and reconnects run from iotconnect_sdk_loop instead of
+                    // SDK threads. Only the WICED MQTT network thread is left. Default: false
+
+    /* session */
+    bool persistent_session; // Connect with clean_session=0, so the broker keeps subscriptions and queued
+                             // devicebound messages while disconnected. Default: false
+
     /* callbacks */
     IotclOtaCallback ota_cb; // callback for OTA events.
     IotclCommandCallback cmd_cb; // callback for command events.
@@ -37,19 +265,142 @@ typedef struct {
     IotConnectStatusCallback status_cb; // callback for connection status
 } IotconnectClientConfig;
 
+// A device connection in addition to the one of iotconnect_sdk_init, for example for a child device of a gateway,
+// or one of many simulated devices in a load test. Each session has its own MQTT connection, in-flight tracking
+// and reconnects. Sessions don't use iotc-c-lib, the queue, coalescing or compression.
+typedef struct IotconnectSession IotconnectSession;
+
+// Receives all inbound messages of the session as they are. Neither topic nor data are NUL terminated.
+typedef void (*IotconnectSessionDataCallback)(IotconnectSession *session, const uint8_t *topic, size_t topic_len,
+                                              const uint8_t *data, size_t len, void *ctx);
+
+typedef void (*IotconnectSessionStatusCallback)(IotconnectSession *session, IotconnectConnectionStatus status,
+                                                void *event_data, void *ctx);
+
+typedef struct {
+    char *env;
+    char *cpid;
+    char *duid;
+    wiced_mqtt_security_t security;
+    IotclSyncResponse *sr; // Optional broker parameters, used instead of running discovery (a local test broker,
+                           // for example). Must outlive the session
+    uint32_t mqtt_timeout_ms; // Default: 10000
+    int num_discovery_tires; // Default: 3
+    uint32_t publish_window; // Default and max: IOTC_SDK_MAX_INFLIGHT
+    uint16_t keepalive_secs; // Default: 30
+    bool persistent_session;
+    bool poll_mode; // reconnects and retransmissions run from iotconnect_session_poll instead of the SDK threads
+    IotconnectSessionDataCallback data_cb; // required
+    IotconnectSessionStatusCallback status_cb; // optional
+    void *ctx; // passed to the callbacks
+} IotconnectSessionConfig;
+
 IotconnectClientConfig *iotconnect_sdk_init_and_get_config();
 
+// Routes messages on topics matching topic_filter to handler, bypassing the IoTConnect JSON processing.
+// topic_filter is an exact topic or a prefix ending with "#". A NULL handler drops the matching messages.
+// Filters outside of the devicebound topic are subscribed to as well.
+// Call after iotconnect_sdk_init_and_get_config and before iotconnect_sdk_init.
+wiced_result_t iotconnect_sdk_register_topic_handler(const char *topic_filter, IotconnectTopicHandler handler,
+                                                     void *ctx);
+
 wiced_result_t iotconnect_sdk_init();
 
+// Same as iotconnect_sdk_init, but returns right away and runs discovery and connect on an SDK thread.
+// Progress is reported through status_cb with IOTC_INIT_* statuses. If queue_size is set, messages sent
+// in the meantime are queued and sent once init completes. iotconnect_sdk_get_lib_config can be used
+// once IOTC_INIT_CONNECTING is reported.
+wiced_result_t iotconnect_sdk_init_async();
+
 bool iotconnect_sdk_is_connected();
 
 IotclConfig *iotconnect_sdk_get_lib_config();
 
+// Creates a telemetry message with the current dtg, or returns NULL if the SDK is not initialized.
+// Prefer it over iotcl_telemetry_create(iotconnect_sdk_get_lib_config()), which can read the dtg while
+// an ON_FORCE_SYNC updates it.
+IotclMessageHandle iotconnect_sdk_telemetry_create();
+
+// Sends the message, or queues it if the connection is down and the queue is configured.
+// With coalesce_size set, telemetry sent without options is merged with other records and sent later.
+// Returns WICED_SUCCESS if the message was sent, queued or added for coalescing.
+// With publisher_queue_len set, the message is only handed to the publisher thread, WICED_OUT_OF_HEAP_SPACE
+// is returned if its queue is full, and later failures are only reported to publish_cb.
+// Over the rate limit, returns WICED_WOULD_BLOCK if the message was dropped, or WICED_TIMEOUT if the wait
+// for the budget timed out. High priority messages are not limited, but count toward the budget.
 wiced_result_t iotconnect_sdk_send_packet(const char *data);
 wiced_result_t iotconnect_sdk_send_data_packet(uint8_t *data, size_t len);
+wiced_result_t iotconnect_sdk_send_packet_ex(const uint8_t *data, size_t len, const IotconnectSendOptions *options);
+
+// Sends a command or OTA ack at high priority, ahead of any queued telemetry
+wiced_result_t iotconnect_sdk_send_ack(const char *data);
+
+// Interval at which the application should send telemetry, as picked from the link conditions.
+// 0 if telemetry_interval_max_ms is not set.
+uint32_t iotconnect_sdk_get_telemetry_interval();
+
+// Publishes the telemetry records that are waiting to be coalesced
+wiced_result_t iotconnect_sdk_flush();
+
+// Same as above, but at the given QoS. Only WICED_MQTT_QOS_DELIVER_AT_MOST_ONCE and AT_LEAST_ONCE are supported.
+wiced_result_t iotconnect_sdk_send_packet_qos(const char *data, wiced_mqtt_qos_level_t qos);
+wiced_result_t iotconnect_sdk_send_data_packet_qos(uint8_t *data, size_t len, wiced_mqtt_qos_level_t qos);
+
+void iotconnect_sdk_get_queue_stats(IotconnectQueueStats *stats);
+
+void iotconnect_sdk_get_priority_stats(IotconnectSendPriority priority, IotconnectPriorityStats *stats);
+
+void iotconnect_sdk_get_reconnect_stats(IotconnectReconnectStats *stats);
+
+void iotconnect_sdk_get_publish_stats(IotconnectPublishStats *stats);
+
+void iotconnect_sdk_get_tls_stats(IotconnectTlsStats *stats);
+
+void iotconnect_sdk_get_keepalive_stats(IotconnectKeepaliveStats *stats);
+
+void iotconnect_sdk_get_coalesce_stats(IotconnectCoalesceStats *stats);
+
+void iotconnect_sdk_get_compression_stats(IotconnectCompressionStats *stats);
+
+void iotconnect_sdk_get_rate_limit_stats(IotconnectRateLimitStats *stats);
+
+void iotconnect_sdk_get_inbound_stats(IotconnectInboundStats *stats);
+
+void iotconnect_sdk_get_publisher_stats(IotconnectPublisherStats *stats);
+
+// With poll_mode, runs the work of the SDK on the calling thread: inbound message callbacks, timers,
+// the outbound queue and reconnects. Inbound messages are processed until budget_ms is spent. Init steps and
+// reconnect attempts can't be split and may take longer. Returns the time in ms until more work is due, 0 if work
+// was left over. Inbound messages can arrive at any time, so call it at least as often as command latency allows.
+uint32_t iotconnect_sdk_loop(uint32_t budget_ms);
+
+// Runs discovery (unless config->sr is set) and connects. Returns NULL on failure.
+// Strings in config must outlive the session. Sessions must be created and destroyed from one thread at a time,
+// and not while iotconnect_sdk_init is running, as they share the discovery client.
+IotconnectSession *iotconnect_session_create(const IotconnectSessionConfig *config);
+
+// Publishes to the session's events topic. Messages are not queued, so this fails while disconnected.
+// expiry_ms in options is ignored.
+wiced_result_t iotconnect_session_send(IotconnectSession *session, const uint8_t *data, size_t len,
+                                       const IotconnectSendOptions *options);
+
+bool iotconnect_session_is_connected(IotconnectSession *session);
+
+void iotconnect_session_get_publish_stats(IotconnectSession *session, IotconnectPublishStats *stats);
+
+void iotconnect_session_get_reconnect_stats(IotconnectSession *session, IotconnectReconnectStats *stats);
+
+// For sessions created with poll_mode. Runs retransmissions and a reconnect attempt if they are due.
+// A reconnect attempt blocks for up to 2x mqtt_timeout_ms. Returns the time in ms until more work is due.
+uint32_t iotconnect_session_poll(IotconnectSession *session);
 
-void iotconnect_sdk_loop();
+// Disconnects and frees the session
+void iotconnect_session_destroy(IotconnectSession *session);
 
+// Closes the connection and releases the publisher, the inbound and outbound queues, coalescing and the rate limit,
+// so that the next init starts over with its config. Messages still in the queue are dropped.
+// Stop sending before calling it.
+// Waits for an async init step that is in progress. Must not be called from a publish callback.
 void iotconnect_sdk_disconnect();
 
 #ifdef __cplusplus
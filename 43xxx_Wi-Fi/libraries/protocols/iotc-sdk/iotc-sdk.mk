@@ -23,7 +23,22 @@ NAME := Lib_iotc-sdk
 $(NAME)_SOURCES := \
 	src/iotc_sdk.c \
 	src/iotc_wiced_discovery.c \
-	src/iotc_wiced_mqtt.c
+	src/iotc_wiced_mqtt.c \
+	src/iotc_sr_cache.c \
+	src/iotc_outbound_queue.c \
+	src/iotc_topic_dispatch.c \
+	src/iotc_tls_session.c \
+	src/iotc_keepalive.c \
+	src/iotc_coalesce.c \
+	src/iotc_compress.c \
+	src/iotc_session.c \
+	src/iotc_rate_limit.c \
+	src/iotc_interval.c \
+	src/iotc_dedup.c \
+	src/iotc_inbound_queue.c \
+	src/iotc_publisher.c \
+	src/iotc_sr_arena.c \
+	src/iotc_worker.c
 
 $(NAME)_COMPONENTS := \
 	protocols/iotc-c-lib \
@@ -0,0 +1,310 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "iotc_coalesce.h"
+#include "iotc_worker.h"
+
+#define MAX_MT_LEN 8
+
+typedef struct {
+    size_t start; // first character of the value
+    size_t end; // one past the last character of the value
+} JsonSpan;
+
+static uint8_t *batch = NULL;
+static size_t batch_len = 0;
+static size_t batch_insert_pos = 0; // offset of the "]" that closes the "d" array
+static uint32_t batch_records = 0;
+static bool batch_array_empty = true; // the "d" array of the batch has no records yet
+static uint8_t batch_mt[MAX_MT_LEN];
+static size_t batch_mt_len = 0;
+
+static uint32_t max_size;
+static uint32_t max_delay_ms;
+static IotcCoalesceSendFn send_fn;
+static wiced_worker_thread_t *flush_worker; // NULL if flushed by iotc_coalesce_poll instead of a timer
+static wiced_time_t batch_started_at;
+static wiced_mutex_t mutex;
+static wiced_timed_event_t flush_event;
+static bool flush_event_registered = false;
+static bool is_initialized = false;
+static IotconnectCoalesceStats stats;
+
+// Just enough JSON scanning to find the top level members of a serialized message, without allocating
+
+static size_t skip_ws(const uint8_t *s, size_t len, size_t i) {
+    while (i < len && (s[i] == ' ' || s[i] == '\t' || s[i] == '\r' || s[i] == '\n')) {
+        i++;
+    }
+    return i;
+}
+
+// i is at the opening quote. Returns the index after the closing quote, or len.
+static size_t skip_string(const uint8_t *s, size_t len, size_t i) {
+    for (i++; i < len; i++) {
+        if (s[i] == '\\') {
+            i++;
+        } else if (s[i] == '"') {
+            return i + 1;
+        }
+    }
+    return len;
+}
+
+static size_t skip_value(const uint8_t *s, size_t len, size_t i) {
+    if (i >= len) {
+        return len;
+    }
+    if (s[i] == '"') {
+        return skip_string(s, len, i);
+    }
+    if (s[i] == '{' || s[i] == '[') {
+        int depth = 0;
+        while (i < len) {
+            if (s[i] == '"') {
+                i = skip_string(s, len, i);
+                continue;
+            }
+            if (s[i] == '{' || s[i] == '[') {
+                depth++;
+            } else if (s[i] == '}' || s[i] == ']') {
+                if (0 == --depth) {
+                    return i + 1;
+                }
+            }
+            i++;
+        }
+        return len;
+    }
+    while (i < len && s[i] != ',' && s[i] != '}' && s[i] != ']') {
+        i++;
+    }
+    return i;
+}
+
+static bool find_member(const uint8_t *s, size_t len, const char *key, JsonSpan *value) {
+    size_t key_len = strlen(key);
+    size_t i = skip_ws(s, len, 0);
+    if (i >= len || s[i] != '{') {
+        return false;
+    }
+    i++;
+    while (true) {
+        i = skip_ws(s, len, i);
+        if (i >= len || s[i] != '"') {
+            return false;
+        }
+        size_t key_start = i + 1;
+        i = skip_string(s, len, i);
+        bool match = (i - key_start - 1 == key_len) && 0 == memcmp(&s[key_start], key, key_len);
+        i = skip_ws(s, len, i);
+        if (i >= len || s[i] != ':') {
+            return false;
+        }
+        i = skip_ws(s, len, i + 1);
+        value->start = i;
+        i = skip_value(s, len, i);
+        value->end = i;
+        if (i >= len) {
+            return false;
+        }
+        if (match) {
+            return true;
+        }
+        i = skip_ws(s, len, i);
+        if (i >= len || s[i] != ',') {
+            return false;
+        }
+        i++;
+    }
+}
+
+static void cancel_flush_timer(void) {
+    if (flush_event_registered) {
+        wiced_rtos_deregister_timed_event(&flush_event);
+        flush_event_registered = false;
+    }
+}
+
+// Must be called with the mutex held
+static wiced_result_t flush_locked(void) {
+    cancel_flush_timer();
+    if (0 == batch_len) {
+        return WICED_SUCCESS;
+    }
+    wiced_result_t ret = send_fn(batch, batch_len);
+    stats.batches++;
+    if (WICED_SUCCESS != ret) {
+        stats.records_dropped += batch_records;
+    }
+    batch_len = 0;
+    batch_records = 0;
+    return ret;
+}
+
+static wiced_result_t on_flush_timer(void *arg) {
+    (void) arg;
+    if (!is_initialized) {
+        return WICED_SUCCESS; // dispatched before deinit deregistered it
+    }
+    wiced_rtos_lock_mutex(&mutex);
+    // timed events are periodic. We want a one-shot.
+    cancel_flush_timer();
+    (void) flush_locked();
+    wiced_rtos_unlock_mutex(&mutex);
+    return WICED_SUCCESS;
+}
+
+wiced_result_t iotc_coalesce_init(uint32_t _max_size, uint32_t _max_delay_ms, wiced_worker_thread_t *worker,
+                                  IotcCoalesceSendFn _send_fn) {
+    if (is_initialized) {
+        return WICED_SUCCESS;
+    }
+    if (!_max_size || !_send_fn) {
+        return WICED_BADARG;
+    }
+    batch = malloc(_max_size);
+    if (!batch) {
+        WPRINT_LIB_INFO(("Unable to allocate the coalescing buffer\n"));
+        return WICED_OUT_OF_HEAP_SPACE;
+    }
+    max_size = _max_size;
+    max_delay_ms = _max_delay_ms;
+    send_fn = _send_fn;
+    flush_worker = worker;
+    batch_len = 0;
+    batch_records = 0;
+    memset(&stats, 0, sizeof(stats));
+    wiced_rtos_init_mutex(&mutex);
+    is_initialized = true;
+    return WICED_SUCCESS;
+}
+
+void iotc_coalesce_deinit(void) {
+    if (!is_initialized) {
+        return;
+    }
+    wiced_rtos_lock_mutex(&mutex);
+    (void) flush_locked(); // also deregisters the timer
+    is_initialized = false;
+    wiced_rtos_unlock_mutex(&mutex);
+    if (flush_worker) {
+        // a flush that is running on the worker still holds the mutex
+        iotc_worker_sync(flush_worker);
+    }
+    wiced_rtos_deinit_mutex(&mutex);
+    free(batch);
+    batch = NULL;
+}
+
+bool iotc_coalesce_is_enabled(void) {
+    return is_initialized;
+}
+
+wiced_result_t iotc_coalesce_add(const uint8_t *data, size_t len) {
+    JsonSpan d;
+    JsonSpan mt;
+    if (!is_initialized) {
+        return WICED_UNSUPPORTED;
+    }
+    bool mergeable = len <= max_size
+                     && find_member(data, len, "d", &d) && data[d.start] == '['
+                     && find_member(data, len, "mt", &mt) && mt.end - mt.start <= MAX_MT_LEN;
+
+    wiced_rtos_lock_mutex(&mutex);
+    if (!mergeable) {
+        // keep the order of messages
+        (void) flush_locked();
+        wiced_rtos_unlock_mutex(&mutex);
+        return WICED_UNSUPPORTED;
+    }
+
+    // records between the brackets of the "d" array
+    size_t records_start = skip_ws(data, len, d.start + 1);
+    size_t records_end = d.end - 1;
+    while (records_end > records_start && skip_ws(data, records_end, records_end - 1) == records_end) {
+        records_end--;
+    }
+    size_t records_len = records_end - records_start;
+
+    bool same_type = batch_mt_len == mt.end - mt.start && 0 == memcmp(batch_mt, &data[mt.start], batch_mt_len);
+    if (batch_len > 0 && (!same_type || batch_len + 1 + records_len > max_size)) {
+        (void) flush_locked();
+    }
+
+    if (0 == batch_len) {
+        memcpy(batch, data, len);
+        batch_len = len;
+        batch_insert_pos = d.end - 1;
+        batch_array_empty = (0 == records_len);
+        batch_mt_len = mt.end - mt.start;
+        memcpy(batch_mt, &data[mt.start], batch_mt_len);
+        wiced_time_get_time(&batch_started_at);
+        if (max_delay_ms && flush_worker && WICED_SUCCESS == wiced_rtos_register_timed_event(
+                &flush_event, flush_worker, on_flush_timer, max_delay_ms, NULL)) {
+            flush_event_registered = true;
+        }
+    } else if (records_len > 0) {
+        // make room in front of the closing bracket and append ",<records>"
+        size_t separator_len = batch_array_empty ? 0 : 1;
+        size_t insert_len = separator_len + records_len;
+        memmove(&batch[batch_insert_pos + insert_len], &batch[batch_insert_pos], batch_len - batch_insert_pos);
+        if (separator_len) {
+            batch[batch_insert_pos] = ',';
+        }
+        memcpy(&batch[batch_insert_pos + separator_len], &data[records_start], records_len);
+        batch_insert_pos += insert_len;
+        batch_array_empty = false;
+        batch_len += insert_len;
+        stats.records_merged++;
+    }
+    batch_records++;
+    stats.records++;
+
+    wiced_result_t ret = WICED_SUCCESS;
+    if (batch_len >= max_size || !max_delay_ms) {
+        ret = flush_locked();
+    }
+    wiced_rtos_unlock_mutex(&mutex);
+    return ret;
+}
+
+wiced_result_t iotc_coalesce_flush(void) {
+    if (!is_initialized) {
+        return WICED_SUCCESS;
+    }
+    wiced_rtos_lock_mutex(&mutex);
+    wiced_result_t ret = flush_locked();
+    wiced_rtos_unlock_mutex(&mutex);
+    return ret;
+}
+
+uint32_t iotc_coalesce_poll(void) {
+    uint32_t next = UINT32_MAX;
+    if (!is_initialized || flush_worker) {
+        return next;
+    }
+    wiced_rtos_lock_mutex(&mutex);
+    if (batch_len > 0) {
+        wiced_time_t now;
+        wiced_time_get_time(&now);
+        uint32_t age = now - batch_started_at;
+        if (age >= max_delay_ms) {
+            (void) flush_locked();
+        } else {
+            next = max_delay_ms - age;
+        }
+    }
+    wiced_rtos_unlock_mutex(&mutex);
+    return next;
+}
+
+void iotc_coalesce_get_stats(IotconnectCoalesceStats *s) {
+    if (s) {
+        *s = stats;
+    }
+}
@@ -0,0 +1,43 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#pragma once
+
+#include <wiced.h>
+#include "iotc_sdk.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Merges telemetry messages into one IoTConnect message with multiple records in its top level "d" array,
+// so that several records share one MQTT PUBLISH. Messages without a "d" array (acks etc.) are not merged.
+
+typedef wiced_result_t (*IotcCoalesceSendFn)(const uint8_t *data, size_t len);
+
+// max_size is the size of the merged message that triggers a flush. The batch is also flushed
+// max_delay_ms after its first record was added, by a timer on worker or, if worker is NULL, by iotc_coalesce_poll.
+wiced_result_t iotc_coalesce_init(uint32_t max_size, uint32_t max_delay_ms, wiced_worker_thread_t *worker,
+                                  IotcCoalesceSendFn send_fn);
+
+// Flushes the pending batch, and waits for a timer flush that is already running
+void iotc_coalesce_deinit(void);
+
+bool iotc_coalesce_is_enabled(void);
+
+// Returns WICED_SUCCESS if the message was added to the batch. Returns WICED_UNSUPPORTED if it can't be merged,
+// in which case the pending batch is flushed and the caller should send the message on its own.
+wiced_result_t iotc_coalesce_add(const uint8_t *data, size_t len);
+
+wiced_result_t iotc_coalesce_flush(void);
+
+// Flushes the batch if it is due. Returns the time in ms until the pending batch is due, or UINT32_MAX.
+uint32_t iotc_coalesce_poll(void);
+
+void iotc_coalesce_get_stats(IotconnectCoalesceStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,148 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "iotc_compress.h"
+
+#define LZF_MAX_LIT (1 << 5)
+#define LZF_MAX_OFF (1 << 13)
+#define LZF_MAX_REF ((1 << 8) + (1 << 3))
+#define LZF_HASH(p) ((((uint32_t) (p)[0] << 16 | (uint32_t) (p)[1] << 8 | (p)[2]) * 2654435761u) >> (32 - IOTC_LZF_HLOG))
+
+static uint16_t *htab = NULL; // positions + 1, 0 if empty
+static wiced_mutex_t mutex;
+static uint32_t min_size;
+static bool is_initialized = false;
+static IotconnectCompressionStats stats;
+static uint64_t total_time_ns; // summed unrounded, so that short messages don't all round down to 0 us
+
+size_t iotc_lzf_compress(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len, uint16_t *table) {
+    size_t ip = 0;
+    size_t op = 1; // out[0] is the control byte of the first literal run
+    size_t lit_start = 0;
+    size_t lit = 0;
+
+    if (0 == in_len || in_len > UINT16_MAX || out_len < 2) {
+        return 0;
+    }
+    memset(table, 0, IOTC_LZF_HSIZE * sizeof(uint16_t));
+
+    while (ip < in_len) {
+        if (ip + 2 < in_len) {
+            uint32_t h = LZF_HASH(&in[ip]);
+            size_t ref = table[h];
+            table[h] = (uint16_t) (ip + 1);
+            if (ref && ip - (ref - 1) <= LZF_MAX_OFF && 0 == memcmp(&in[ref - 1], &in[ip], 3)) {
+                size_t r = ref - 1;
+                size_t off = ip - r - 1;
+                size_t max_len = in_len - ip < LZF_MAX_REF ? in_len - ip : LZF_MAX_REF;
+                size_t len = 3;
+                while (len < max_len && in[r + len] == in[ip + len]) {
+                    len++;
+                }
+                if (op + 4 > out_len) {
+                    return 0;
+                }
+                // close the literal run, or drop its unused control byte
+                if (lit) {
+                    out[lit_start] = (uint8_t) (lit - 1);
+                } else {
+                    op--;
+                }
+                size_t l = len - 2;
+                if (l < 7) {
+                    out[op++] = (uint8_t) ((l << 5) | (off >> 8));
+                } else {
+                    out[op++] = (uint8_t) ((7 << 5) | (off >> 8));
+                    out[op++] = (uint8_t) (l - 7);
+                }
+                out[op++] = (uint8_t) off;
+                // index the positions inside the match, so that later repeats can refer to them
+                for (size_t p = ip + 1; p < ip + len && p + 2 < in_len; p++) {
+                    table[LZF_HASH(&in[p])] = (uint16_t) (p + 1);
+                }
+                ip += len;
+                lit = 0;
+                lit_start = op++;
+                continue;
+            }
+        }
+        if (op + 1 > out_len) {
+            return 0;
+        }
+        out[op++] = in[ip++];
+        if (++lit == LZF_MAX_LIT) {
+            out[lit_start] = (uint8_t) (lit - 1);
+            lit = 0;
+            lit_start = op++;
+        }
+    }
+    if (lit) {
+        out[lit_start] = (uint8_t) (lit - 1);
+    } else {
+        op--;
+    }
+    return op <= out_len ? op : 0;
+}
+
+wiced_result_t iotc_compress_init(uint32_t _min_size) {
+    if (is_initialized) {
+        return WICED_SUCCESS;
+    }
+    htab = malloc(IOTC_LZF_HSIZE * sizeof(uint16_t));
+    if (!htab) {
+        WPRINT_LIB_INFO(("Unable to allocate the compression table\n"));
+        return WICED_OUT_OF_HEAP_SPACE;
+    }
+    min_size = _min_size;
+    memset(&stats, 0, sizeof(stats));
+    total_time_ns = 0;
+    // a message compresses in well under the 1 ms resolution of wiced_time_get_time
+    wiced_init_nanosecond_clock();
+    wiced_rtos_init_mutex(&mutex);
+    is_initialized = true;
+    return WICED_SUCCESS;
+}
+
+bool iotc_compress_is_enabled(void) {
+    return is_initialized;
+}
+
+uint8_t *iotc_compress(const uint8_t *data, size_t len, size_t *compressed_len) {
+    if (!is_initialized || len < min_size) {
+        return NULL;
+    }
+    // not worth it unless it saves at least an eighth
+    size_t out_len = len - len / 8;
+    uint8_t *out = malloc(out_len);
+    if (!out) {
+        return NULL;
+    }
+    wiced_rtos_lock_mutex(&mutex);
+    uint64_t start = wiced_get_nanosecond_clock_value();
+    size_t ret = iotc_lzf_compress(data, len, out, out_len, htab);
+    total_time_ns += wiced_get_nanosecond_clock_value() - start;
+    stats.attempts++;
+    if (ret) {
+        stats.compressed++;
+        stats.bytes_in += len;
+        stats.bytes_out += ret;
+    }
+    wiced_rtos_unlock_mutex(&mutex);
+    if (!ret) {
+        free(out);
+        return NULL;
+    }
+    *compressed_len = ret;
+    return out;
+}
+
+void iotc_compress_get_stats(IotconnectCompressionStats *s) {
+    if (s) {
+        *s = stats;
+        s->total_time_us = (uint32_t) (total_time_ns / 1000);
+    }
+}
@@ -0,0 +1,42 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#pragma once
+
+#include <wiced.h>
+#include "iotc_sdk.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Compresses outbound payloads in the LZF format (liblzf compatible), which needs no dictionary
+// on the decompressing side and only a small hash table on the device.
+
+// Appended to the publish topic of compressed messages as the content encoding property
+#ifndef IOTC_SDK_COMPRESSED_TOPIC_PROPERTY
+#define IOTC_SDK_COMPRESSED_TOPIC_PROPERTY "$.ce=lzf"
+#endif
+
+// Messages shorter than min_size are not compressed
+wiced_result_t iotc_compress_init(uint32_t min_size);
+
+bool iotc_compress_is_enabled(void);
+
+// Returns a compressed copy of data, which must be freed, or NULL if compression would not make it smaller.
+uint8_t *iotc_compress(const uint8_t *data, size_t len, size_t *compressed_len);
+
+#define IOTC_LZF_HLOG 10
+#define IOTC_LZF_HSIZE (1 << IOTC_LZF_HLOG)
+
+// Compresses in_len bytes into out. Returns the compressed length, or 0 if it doesn't fit into out_len.
+// htab must have IOTC_LZF_HSIZE entries.
+size_t iotc_lzf_compress(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len, uint16_t *htab);
+
+void iotc_compress_get_stats(IotconnectCompressionStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,81 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#include <string.h>
+#include "iotc_dedup.h"
+
+#define ACK_ID_KEY "\"ackId\""
+
+typedef struct {
+    uint32_t hash; // 0 if the slot is free
+    wiced_time_t seen_at;
+} DedupEntry;
+
+static DedupEntry entries[IOTC_SDK_DEDUP_CACHE_SIZE];
+static uint32_t next_entry = 0; // replaced next, oldest first
+
+static uint32_t fnv1a(uint32_t hash, const uint8_t *p, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Finds the string value of "ackId" without parsing the JSON. Returns NULL if there is none.
+static const uint8_t *find_ack_id(const uint8_t *data, size_t len, size_t *value_len) {
+    const size_t key_len = sizeof(ACK_ID_KEY) - 1;
+    for (size_t i = 0; i + key_len < len; i++) {
+        if (data[i] != '"' || 0 != memcmp(&data[i], ACK_ID_KEY, key_len)) {
+            continue;
+        }
+        size_t p = i + key_len;
+        while (p < len && (data[p] == ' ' || data[p] == ':')) {
+            p++;
+        }
+        if (p >= len || data[p] != '"') {
+            return NULL;
+        }
+        size_t start = ++p;
+        while (p < len && data[p] != '"') {
+            p++;
+        }
+        if (p >= len || p == start) {
+            return NULL;
+        }
+        *value_len = p - start;
+        return &data[start];
+    }
+    return NULL;
+}
+
+void iotc_dedup_reset(void) {
+    memset(entries, 0, sizeof(entries));
+    next_entry = 0;
+}
+
+bool iotc_dedup_is_duplicate(const uint8_t *topic, size_t topic_len, const uint8_t *data, size_t len) {
+    size_t key_len;
+    const uint8_t *key = find_ack_id(data, len, &key_len);
+    if (!key) {
+        return false; // nothing tells a redelivery from the same message sent again
+    }
+    uint32_t hash = fnv1a(fnv1a(2166136261u, topic, topic_len), key, key_len);
+    if (0 == hash) {
+        hash = 1;
+    }
+
+    wiced_time_t now;
+    wiced_time_get_time(&now);
+    for (int i = 0; i < IOTC_SDK_DEDUP_CACHE_SIZE; i++) {
+        if (entries[i].hash == hash && now - entries[i].seen_at < IOTC_SDK_DEDUP_TTL_MS) {
+            return true;
+        }
+    }
+    entries[next_entry].hash = hash;
+    entries[next_entry].seen_at = now;
+    next_entry = (next_entry + 1) % IOTC_SDK_DEDUP_CACHE_SIZE;
+    return false;
+}
@@ -0,0 +1,37 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#pragma once
+
+#include <wiced.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Number of recent inbound messages remembered
+#ifndef IOTC_SDK_DEDUP_CACHE_SIZE
+#define IOTC_SDK_DEDUP_CACHE_SIZE 16
+#endif
+
+// How long a message is remembered. Redeliveries arrive after a reconnect, so this should cover the reconnect backoff.
+#ifndef IOTC_SDK_DEDUP_TTL_MS
+#define IOTC_SDK_DEDUP_TTL_MS (10 * 60 * 1000)
+#endif
+
+// Recognizes QoS1 redeliveries of inbound messages, which WICED passes on without the DUP flag or packet ID.
+// Messages are keyed on their topic and the IoTConnect "ackId", so a redelivered command is recognized
+// even if the payload differs otherwise. Messages without a string ackId (or with "ackId": null) are never
+// duplicates, since a command that is legitimately sent twice looks the same as a redelivery.
+// Not thread safe. Inbound messages are processed one at a time.
+
+void iotc_dedup_reset(void);
+
+// Returns true if a message with the same ackId was seen recently. Otherwise remembers it and returns false.
+bool iotc_dedup_is_duplicate(const uint8_t *topic, size_t topic_len, const uint8_t *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
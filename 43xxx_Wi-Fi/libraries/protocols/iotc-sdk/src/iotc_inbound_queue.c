@@ -0,0 +1,170 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "iotc_inbound_queue.h"
+
+#define RECORD_PAD 0xFFFF // marks the unused space at the end of the ring
+#define RECORD_ALIGN(x) (((x) + 3) & ~3u)
+
+// How often a blocked producer checks for space
+#define BLOCK_POLL_MS 5
+
+typedef struct {
+    uint16_t topic_len; // or RECORD_PAD
+    uint16_t reserved;
+    uint32_t len;
+} InboundRecordHeader;
+
+static uint8_t *ring = NULL;
+static uint32_t capacity; // power of two
+// Free running positions. Only the producer writes tail and only the consumer writes head.
+static volatile uint32_t head = 0;
+static volatile uint32_t tail = 0;
+static IotconnectInboundOverflowPolicy overflow_policy;
+static uint32_t block_timeout;
+static volatile uint32_t dropped = 0;
+static volatile uint32_t max_used = 0;
+
+// Orders the record contents before the position update that publishes or releases them
+#define MEMORY_BARRIER() __sync_synchronize()
+
+wiced_result_t iotc_inbound_queue_init(uint32_t size, IotconnectInboundOverflowPolicy policy,
+                                       uint32_t block_timeout_ms) {
+    if (ring) {
+        return WICED_SUCCESS;
+    }
+    if (size < 2 * sizeof(InboundRecordHeader)) {
+        return WICED_BADARG;
+    }
+    capacity = 1;
+    while (capacity <= size / 2) {
+        capacity *= 2;
+    }
+    ring = malloc(capacity);
+    if (!ring) {
+        WPRINT_LIB_INFO(("Unable to allocate the inbound queue\n"));
+        return WICED_OUT_OF_HEAP_SPACE;
+    }
+    head = tail = 0;
+    dropped = max_used = 0;
+    overflow_policy = policy;
+    block_timeout = block_timeout_ms;
+    return WICED_SUCCESS;
+}
+
+// Returns the number of bytes to skip before the record (padding at the end of the ring),
+// or UINT32_MAX if the record does not fit right now
+static uint32_t reserve(uint32_t t, uint32_t size) {
+    uint32_t offset = t & (capacity - 1);
+    uint32_t to_end = capacity - offset;
+    uint32_t skip = size > to_end ? to_end : 0;
+    if (size + skip > capacity - (t - head)) {
+        return UINT32_MAX;
+    }
+    return skip;
+}
+
+// The data is followed by a NUL, so that the consumer can use it as a string in place
+static uint32_t record_size(uint32_t topic_len, size_t len) {
+    return RECORD_ALIGN(sizeof(InboundRecordHeader) + topic_len + len + 1);
+}
+
+wiced_result_t iotc_inbound_queue_push(const uint8_t *data, size_t len, const uint8_t *topic, uint32_t topic_len) {
+    uint32_t size = record_size(topic_len, len);
+    if (!ring || topic_len >= RECORD_PAD || size > capacity) {
+        dropped++;
+        return WICED_OUT_OF_HEAP_SPACE;
+    }
+
+    uint32_t t = tail;
+    uint32_t skip = reserve(t, size);
+    uint32_t waited = 0;
+    while (UINT32_MAX == skip && overflow_policy == IOTC_INBOUND_BLOCK && waited < block_timeout) {
+        // backpressure: the broker can't send more while the MQTT thread waits here
+        wiced_rtos_delay_milliseconds(BLOCK_POLL_MS);
+        waited += BLOCK_POLL_MS;
+        skip = reserve(t, size);
+    }
+    if (UINT32_MAX == skip) {
+        dropped++;
+        return WICED_OUT_OF_HEAP_SPACE;
+    }
+
+    uint32_t offset = t & (capacity - 1);
+    if (skip) {
+        if (skip >= sizeof(InboundRecordHeader)) {
+            InboundRecordHeader pad = {.topic_len = RECORD_PAD};
+            memcpy(&ring[offset], &pad, sizeof(pad));
+        }
+        t += skip;
+        offset = 0;
+    }
+    InboundRecordHeader header = {.topic_len = (uint16_t) topic_len, .len = (uint32_t) len};
+    memcpy(&ring[offset], &header, sizeof(header));
+    memcpy(&ring[offset + sizeof(header)], topic, topic_len);
+    memcpy(&ring[offset + sizeof(header) + topic_len], data, len);
+    ring[offset + sizeof(header) + topic_len + len] = 0;
+    MEMORY_BARRIER();
+    tail = t + size;
+
+    uint32_t used = tail - head;
+    if (used > max_used) {
+        max_used = used;
+    }
+    return WICED_SUCCESS;
+}
+
+uint32_t iotc_inbound_queue_drain(IotcInboundHandler handler, uint32_t max_messages) {
+    uint32_t num_handled = 0;
+    if (!ring) {
+        return 0;
+    }
+    uint32_t h = head;
+    while (num_handled < max_messages && h != tail) {
+        MEMORY_BARRIER();
+        uint32_t offset = h & (capacity - 1);
+        uint32_t to_end = capacity - offset;
+        InboundRecordHeader header;
+        if (to_end < sizeof(header)) {
+            h += to_end;
+            continue;
+        }
+        memcpy(&header, &ring[offset], sizeof(header));
+        if (header.topic_len == RECORD_PAD) {
+            h += to_end;
+            continue;
+        }
+        const uint8_t *topic = &ring[offset + sizeof(header)];
+        handler(topic + header.topic_len, header.len, topic, header.topic_len);
+        num_handled++;
+        if (!ring) {
+            return num_handled; // the handler disconnected, e.g. on a close command
+        }
+        h += record_size(header.topic_len, header.len);
+        MEMORY_BARRIER();
+        head = h; // releases the space to the producer
+    }
+    head = h;
+    return num_handled;
+}
+
+void iotc_inbound_queue_deinit(void) {
+    free(ring);
+    ring = NULL;
+    head = tail = 0;
+}
+
+bool iotc_inbound_queue_is_empty(void) {
+    return !ring || head == tail;
+}
+
+void iotc_inbound_queue_get_stats(IotconnectInboundStats *stats) {
+    if (stats) {
+        stats->dropped = dropped;
+        stats->max_queue_used = max_used;
+    }
+}
@@ -0,0 +1,44 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#pragma once
+
+#include <wiced.h>
+#include "iotc_sdk.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Hands inbound messages from the MQTT thread to the thread that processes them.
+// A single producer and a single consumer share a ring of variable length records without a lock,
+// so the MQTT thread never waits on a slow consumer unless IOTC_INBOUND_BLOCK is configured.
+
+typedef void (*IotcInboundHandler)(const uint8_t *data, size_t len, const uint8_t *topic, const uint32_t topic_len);
+
+// size is rounded down to a power of two
+wiced_result_t iotc_inbound_queue_init(uint32_t size, IotconnectInboundOverflowPolicy policy,
+                                       uint32_t block_timeout_ms);
+
+// Producer side. Copies the message. Returns WICED_OUT_OF_HEAP_SPACE if it was dropped.
+wiced_result_t iotc_inbound_queue_push(const uint8_t *data, size_t len, const uint8_t *topic, uint32_t topic_len);
+
+// Consumer side. Calls handler for up to max_messages queued messages, in order. The message memory is
+// only valid during the call. data[len] is 0, so text messages can be used as strings without a copy.
+// Returns the number of handled messages.
+uint32_t iotc_inbound_queue_drain(IotcInboundHandler handler, uint32_t max_messages);
+
+// Frees the ring, so that the next init applies its own size and policy. Messages that were not drained are
+// dropped. The producer must have stopped. May be called from the drain handler, which ends the drain.
+void iotc_inbound_queue_deinit(void);
+
+bool iotc_inbound_queue_is_empty(void);
+
+// Fills the queue related fields: dropped and max_queue_used
+void iotc_inbound_queue_get_stats(IotconnectInboundStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
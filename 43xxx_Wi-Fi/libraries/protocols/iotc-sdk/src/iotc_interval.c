@@ -0,0 +1,72 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#include <string.h>
+#include "iotc_interval.h"
+
+static uint32_t min_interval = 0;
+static uint32_t max_interval = 0;
+static uint32_t interval = 0;
+static uint32_t base_rtt = 0; // lowest recent average PUBACK latency. 0 until the first acknowledgement
+static IotcLinkSample last;
+
+void iotc_interval_init(uint32_t min_ms, uint32_t max_ms) {
+    if (0 == min_ms) {
+        min_ms = 1;
+    }
+    if (max_ms < min_ms) {
+        max_ms = min_ms;
+    }
+    min_interval = min_ms;
+    max_interval = max_ms;
+    interval = min_ms; // optimistic until the link proves otherwise
+    base_rtt = 0;
+    memset(&last, 0, sizeof(last));
+}
+
+static bool is_congested(const IotcLinkSample *s, uint32_t acknowledged) {
+    if (s->disconnects != last.disconnects || s->failed != last.failed || s->retransmits != last.retransmits) {
+        return true;
+    }
+    if (s->queue_depth > last.queue_depth) {
+        return true; // messages are produced faster than the link takes them
+    }
+    if (0 == acknowledged) {
+        return false;
+    }
+    uint32_t rtt = (s->total_latency_ms - last.total_latency_ms) / acknowledged;
+    bool slow = base_rtt && rtt > IOTC_SDK_INTERVAL_RTT_FLOOR_MS && rtt > base_rtt * IOTC_SDK_INTERVAL_RTT_FACTOR;
+    if (0 == base_rtt || rtt < base_rtt) {
+        base_rtt = rtt ? rtt : 1;
+    } else {
+        base_rtt += (rtt - base_rtt) / 16; // follow a path that got slower for good
+    }
+    return slow;
+}
+
+uint32_t iotc_interval_update(const IotcLinkSample *s) {
+    if (!max_interval || !s) {
+        return interval;
+    }
+    if (s->acknowledged < last.acknowledged || s->disconnects < last.disconnects
+        || s->retransmits < last.retransmits || s->failed < last.failed) {
+        last = *s; // counters were reset by a new connection
+        return interval;
+    }
+    uint32_t acknowledged = s->acknowledged - last.acknowledged;
+
+    if (is_congested(s, acknowledged)) {
+        interval = interval > max_interval / 2 ? max_interval : interval * 2;
+    } else if (acknowledged > 0 && 0 == s->queue_depth) {
+        uint32_t decrease = interval / 8 ? interval / 8 : 1;
+        interval = interval - decrease < min_interval ? min_interval : interval - decrease;
+    }
+    last = *s;
+    return interval;
+}
+
+uint32_t iotc_interval_get(void) {
+    return interval;
+}
@@ -0,0 +1,48 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#pragma once
+
+#include <wiced.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// PUBACK latency above this multiple of the baseline latency counts as congestion
+#ifndef IOTC_SDK_INTERVAL_RTT_FACTOR
+#define IOTC_SDK_INTERVAL_RTT_FACTOR 3
+#endif
+
+// ... unless it is below this, which keeps jitter on a fast link from being taken for congestion
+#ifndef IOTC_SDK_INTERVAL_RTT_FLOOR_MS
+#define IOTC_SDK_INTERVAL_RTT_FLOOR_MS 300
+#endif
+
+// Picks the telemetry interval from the link conditions, the way congestion control picks a window:
+// the interval is doubled when the link shows signs of congestion (retransmissions, failed publishes,
+// disconnects, a growing queue or a PUBACK latency well above the baseline) and shortened by 1/8
+// after a healthy period. Periods without acknowledged messages leave the interval unchanged.
+
+// Cumulative counters, as reported by the publish, reconnect and queue stats
+typedef struct {
+    uint32_t acknowledged;
+    uint32_t total_latency_ms;
+    uint32_t retransmits;
+    uint32_t failed;
+    uint32_t disconnects;
+    uint32_t queue_depth; // current, not cumulative
+} IotcLinkSample;
+
+void iotc_interval_init(uint32_t min_ms, uint32_t max_ms);
+
+// Evaluates the period since the previous sample and returns the new interval
+uint32_t iotc_interval_update(const IotcLinkSample *sample);
+
+uint32_t iotc_interval_get(void);
+
+#ifdef __cplusplus
+}
+#endif
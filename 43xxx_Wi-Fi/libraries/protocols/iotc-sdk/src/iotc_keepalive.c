@@ -0,0 +1,107 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#include <string.h>
+#include "iotc_keepalive.h"
+
+void iotc_keepalive_configure(IotcKeepalive *ka, uint16_t interval_secs, uint16_t probe_max_secs) {
+    if (0 == interval_secs) {
+        interval_secs = IOTC_SDK_KEEPALIVE_INTERVAL_SECS;
+    }
+    if (probe_max_secs <= interval_secs) {
+        probe_max_secs = 0;
+    }
+    if (interval_secs == ka->base_interval && probe_max_secs == ka->probe_max) {
+        return;
+    }
+    ka->base_interval = interval_secs;
+    ka->probe_max = probe_max_secs;
+    ka->next_interval = ka->good_interval = ka->base_interval;
+    ka->learned = false;
+    memset(&ka->stats, 0, sizeof(ka->stats));
+}
+
+uint16_t iotc_keepalive_get_interval(IotcKeepalive *ka) {
+    return ka->next_interval ? ka->next_interval : IOTC_SDK_KEEPALIVE_INTERVAL_SECS;
+}
+
+void iotc_keepalive_on_connected(IotcKeepalive *ka) {
+    ka->active_interval = iotc_keepalive_get_interval(ka);
+    ka->stats.interval_secs = ka->active_interval;
+    wiced_time_get_time(&ka->period_start);
+    ka->last_outbound = ka->last_inbound = ka->period_start;
+    ka->idle_pending = false;
+    ka->survived_periods = 0;
+    ka->is_connected = true;
+}
+
+void iotc_keepalive_on_connection_lost(IotcKeepalive *ka) {
+    if (!ka->is_connected) {
+        return;
+    }
+    ka->is_connected = false;
+    if (!ka->probe_max || ka->learned || ka->active_interval <= ka->good_interval) {
+        return;
+    }
+    wiced_time_t now;
+    wiced_time_get_time(&now);
+    if (now - ka->last_inbound >= (uint32_t) ka->active_interval * 1000) {
+        // the link was idle for a whole interval and then died. Assume the NAT mapping timed out.
+        ka->learned = true;
+        ka->stats.nat_timeout_secs = ka->active_interval;
+        ka->next_interval = ka->good_interval;
+        WPRINT_LIB_INFO(("[MQTT] Idle link dropped at %u s keepalive. Using %u s\n",
+                ka->active_interval, ka->good_interval));
+    }
+}
+
+void iotc_keepalive_on_outbound(IotcKeepalive *ka) {
+    wiced_time_get_time(&ka->last_outbound);
+}
+
+void iotc_keepalive_on_inbound(IotcKeepalive *ka) {
+    wiced_time_get_time(&ka->last_inbound);
+}
+
+// The connection outlasted an idle period by another whole period, so the pings at active_interval kept it up
+static void on_idle_period_survived(IotcKeepalive *ka) {
+    ka->survived_periods++;
+    if (ka->active_interval > ka->good_interval) {
+        ka->good_interval = ka->active_interval;
+    }
+    if (ka->probe_max && !ka->learned && ka->survived_periods >= IOTC_SDK_KEEPALIVE_PROBE_PERIODS
+        && ka->next_interval == ka->active_interval && ka->active_interval < ka->probe_max) {
+        // requested on the next connect
+        uint32_t stretched = (uint32_t) ka->active_interval + ka->active_interval / 2;
+        ka->next_interval = (uint16_t) (stretched > ka->probe_max ? ka->probe_max : stretched);
+    }
+}
+
+void iotc_keepalive_tick(IotcKeepalive *ka) {
+    if (!ka->is_connected || 0 == ka->active_interval) {
+        return;
+    }
+    wiced_time_t now;
+    wiced_time_get_time(&now);
+    if (now - ka->period_start < (uint32_t) ka->active_interval * 1000) {
+        return;
+    }
+    if (ka->idle_pending) {
+        ka->idle_pending = false;
+        on_idle_period_survived(ka);
+    }
+    if ((int32_t) (ka->last_outbound - ka->period_start) < 0 && (int32_t) (ka->last_inbound - ka->period_start) < 0) {
+        // only pings kept the link alive during this period
+        ka->stats.idle_periods++;
+        ka->idle_pending = true;
+    }
+    ka->period_start = now;
+}
+
+void iotc_keepalive_get_stats(IotcKeepalive *ka, IotconnectKeepaliveStats *s) {
+    if (s) {
+        *s = ka->stats;
+    }
+}
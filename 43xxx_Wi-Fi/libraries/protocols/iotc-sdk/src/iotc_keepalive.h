@@ -0,0 +1,69 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#pragma once
+
+#include <wiced.h>
+#include "iotc_sdk.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef IOTC_SDK_KEEPALIVE_INTERVAL_SECS
+#define IOTC_SDK_KEEPALIVE_INTERVAL_SECS 30
+#endif
+
+// Idle periods the link has to survive at an interval before a longer one is probed
+#ifndef IOTC_SDK_KEEPALIVE_PROBE_PERIODS
+#define IOTC_SDK_KEEPALIVE_PROBE_PERIODS 3
+#endif
+
+// Tracks inbound and outbound activity and picks the keepalive interval for each connect.
+// The PINGREQ itself is sent by the WICED MQTT library, which only lets the interval be chosen at connect time,
+// so the interval of a live connection never changes. When probing is enabled, idle periods that the connection
+// survives at its interval make the next connect request a longer one. If an idle link is dropped, reconnects
+// fall back to the last good interval, which marks the NAT idle timeout as learned.
+
+// State of one connection. Zero-initialize before the first iotc_keepalive_configure.
+typedef struct {
+    uint16_t base_interval;
+    uint16_t probe_max; // 0 if probing is disabled
+    uint16_t next_interval; // requested in the next CONNECT
+    uint16_t active_interval; // in effect for the current connection
+    uint16_t good_interval; // longest interval at which an idle link survived
+    bool learned; // the NAT idle timeout was found and probing stopped
+    bool is_connected;
+    bool idle_pending; // the last period was idle. It counts as survived if the connection outlasts the next one.
+    uint32_t survived_periods; // at active_interval
+    wiced_time_t period_start;
+    wiced_time_t last_outbound;
+    wiced_time_t last_inbound;
+    IotconnectKeepaliveStats stats;
+} IotcKeepalive;
+
+// Keeps the learned state if the parameters did not change since the last call.
+void iotc_keepalive_configure(IotcKeepalive *ka, uint16_t interval_secs, uint16_t probe_max_secs);
+
+// Interval to request in the next CONNECT
+uint16_t iotc_keepalive_get_interval(IotcKeepalive *ka);
+
+void iotc_keepalive_on_connected(IotcKeepalive *ka);
+
+// Call on a connection loss that was not requested by the application
+void iotc_keepalive_on_connection_lost(IotcKeepalive *ka);
+
+void iotc_keepalive_on_outbound(IotcKeepalive *ka);
+
+void iotc_keepalive_on_inbound(IotcKeepalive *ka);
+
+// Call periodically while connected, at least a few times per interval
+void iotc_keepalive_tick(IotcKeepalive *ka);
+
+void iotc_keepalive_get_stats(IotcKeepalive *ka, IotconnectKeepaliveStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,439 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "iotc_outbound_queue.h"
+
+#define RECORD_PAD 0xFFFF // marks the unused space at the end of the ring
+#define RECORD_ALIGN(x) (((x) + 3) & ~3u)
+
+typedef struct {
+    uint16_t len; // payload length or RECORD_PAD
+    uint8_t qos;
+    uint8_t flags;
+    uint32_t expires_at; // wiced_time_t in ms, 0 if the record does not expire
+    uint32_t queued_at; // wiced_time_t in ms
+    IotconnectPublishCallback cb;
+    void *ctx;
+} OqRecordHeader;
+
+// A ring of variable length records, each record contiguous in memory (or storage).
+// If a record does not fit at the end of the ring, the end is padded and the record is written at the start.
+typedef struct {
+    uint8_t *ram; // either ram or nv is set
+    IotconnectNvStorage *nv;
+    uint32_t capacity;
+    uint32_t head; // offset of the oldest record
+    uint32_t tail; // offset where the next record will be written
+    uint32_t count;
+    uint32_t used; // bytes, including padding
+} OqRing;
+
+static OqRing ram_ring;
+static OqRing spill_ring;
+static OqRing priority_ring; // RAM only. Drained before the other two
+static IotconnectQueueDropPolicy drop_policy;
+static IotconnectQueueStats stats;
+static IotconnectPriorityStats class_stats[IOTC_PRIORITY_NUM];
+static wiced_mutex_t mutex;
+static bool is_initialized = false;
+// The ring whose oldest record is being sent by a drain, without the lock. That record stays in place until then.
+static OqRing *sending = NULL;
+
+static bool ring_write(OqRing *r, uint32_t offset, const void *data, uint32_t len) {
+    if (r->ram) {
+        memcpy(&r->ram[offset], data, len);
+        return true;
+    }
+    return WICED_SUCCESS == r->nv->write(r->nv->ctx, offset, data, len);
+}
+
+static bool ring_read(OqRing *r, uint32_t offset, void *data, uint32_t len) {
+    if (r->ram) {
+        memcpy(data, &r->ram[offset], len);
+        return true;
+    }
+    return WICED_SUCCESS == r->nv->read(r->nv->ctx, offset, data, len);
+}
+
+static uint32_t record_size(size_t len) {
+    return RECORD_ALIGN(sizeof(OqRecordHeader) + len);
+}
+
+// Finds space for a record of the given payload length and returns the offset of the record,
+// or UINT32_MAX if it does not fit.
+static uint32_t ring_reserve(OqRing *r, size_t len) {
+    uint32_t size = record_size(len);
+    if (0 == r->count) {
+        r->head = r->tail = r->used = 0;
+    }
+    if (r->count == 0 || r->tail > r->head) {
+        if (size <= r->capacity - r->tail) {
+            return r->tail;
+        }
+        if (size <= r->head) {
+            // wrap around
+            uint32_t remaining = r->capacity - r->tail;
+            if (remaining >= sizeof(OqRecordHeader)) {
+                OqRecordHeader pad = {.len = RECORD_PAD};
+                if (!ring_write(r, r->tail, &pad, sizeof(pad))) {
+                    return UINT32_MAX;
+                }
+            }
+            r->used += remaining;
+            r->tail = 0;
+            return 0;
+        }
+        return UINT32_MAX;
+    }
+    if (size <= r->head - r->tail) {
+        return r->tail;
+    }
+    return UINT32_MAX;
+}
+
+static void ring_commit(OqRing *r, size_t len) {
+    uint32_t size = record_size(len);
+    r->tail += size;
+    r->used += size;
+    r->count++;
+}
+
+static bool ring_push(OqRing *r, const uint8_t *data, size_t len, const OqRecordHeader *template) {
+    if (!r->capacity || len >= RECORD_PAD) {
+        return false;
+    }
+    uint32_t offset = ring_reserve(r, len);
+    if (UINT32_MAX == offset) {
+        return false;
+    }
+    OqRecordHeader header = *template;
+    header.len = (uint16_t) len;
+    if (!ring_write(r, offset, &header, sizeof(header))
+        || !ring_write(r, offset + sizeof(header), data, len)) {
+        return false;
+    }
+    ring_commit(r, len);
+    return true;
+}
+
+// Reads the header of the oldest record, skipping the padding. Ring must not be empty.
+static bool ring_peek(OqRing *r, OqRecordHeader *header) {
+    if (r->capacity - r->head < sizeof(OqRecordHeader)) {
+        r->used -= r->capacity - r->head;
+        r->head = 0;
+    }
+    if (!ring_read(r, r->head, header, sizeof(OqRecordHeader))) {
+        return false;
+    }
+    if (header->len == RECORD_PAD) {
+        r->used -= r->capacity - r->head;
+        r->head = 0;
+        return ring_read(r, r->head, header, sizeof(OqRecordHeader));
+    }
+    return true;
+}
+
+static void ring_pop(OqRing *r, const OqRecordHeader *header) {
+    uint32_t size = record_size(header->len);
+    r->head += size;
+    r->used -= size;
+    r->count--;
+    if (0 == r->count) {
+        r->head = r->tail = r->used = 0;
+    }
+}
+
+static bool is_expired(uint32_t expires_at, wiced_time_t now) {
+    return expires_at != 0 && (int32_t) (now - expires_at) >= 0;
+}
+
+static void notify_dropped(const OqRecordHeader *header) {
+    if (header->cb) {
+        header->cb(WICED_ERROR, 0, header->ctx);
+    }
+}
+
+// Moves records from the spill storage into RAM while they fit, so that the RAM ring stays in front.
+static void migrate_spilled(void) {
+    while (spill_ring.count > 0 && sending != &spill_ring) {
+        OqRecordHeader header;
+        if (!ring_peek(&spill_ring, &header)) {
+            return;
+        }
+        uint32_t offset = ring_reserve(&ram_ring, header.len);
+        if (UINT32_MAX == offset) {
+            return;
+        }
+        memcpy(&ram_ring.ram[offset], &header, sizeof(header));
+        if (!ring_read(&spill_ring, spill_ring.head + sizeof(header), &ram_ring.ram[offset + sizeof(header)],
+                       header.len)) {
+            return;
+        }
+        ring_commit(&ram_ring, header.len);
+        ring_pop(&spill_ring, &header);
+    }
+}
+
+// The caller notifies the owner of the dropped record once the lock is released
+static bool drop_oldest(IotconnectSendPriority priority, OqRecordHeader *header) {
+    OqRing *r = ram_ring.count > 0 ? &ram_ring : &spill_ring;
+    if (priority == IOTC_PRIORITY_HIGH) {
+        r = &priority_ring;
+    }
+    if (0 == r->count || r == sending || !ring_peek(r, header)) {
+        return false;
+    }
+    ring_pop(r, header);
+    stats.dropped_overflow++;
+    class_stats[priority].dropped++;
+    if (r != &priority_ring) {
+        migrate_spilled();
+    }
+    return true;
+}
+
+static bool push_in_order(const uint8_t *data, size_t len, const OqRecordHeader *header,
+                          IotconnectSendPriority priority) {
+    if (priority == IOTC_PRIORITY_HIGH) {
+        return ring_push(&priority_ring, data, len, header);
+    }
+    // once anything is spilled, new messages have to go behind it
+    if (0 == spill_ring.count && ring_push(&ram_ring, data, len, header)) {
+        return true;
+    }
+    return ring_push(&spill_ring, data, len, header);
+}
+
+static IotconnectSendPriority ring_priority(OqRing *r) {
+    return r == &priority_ring ? IOTC_PRIORITY_HIGH : IOTC_PRIORITY_NORMAL;
+}
+
+wiced_result_t iotc_outbound_queue_init(const IotcOutboundQueueConfig *config) {
+    if (is_initialized) {
+        return WICED_SUCCESS;
+    }
+    if (!config || !config->size) {
+        return WICED_BADARG;
+    }
+    memset(&ram_ring, 0, sizeof(ram_ring));
+    memset(&spill_ring, 0, sizeof(spill_ring));
+    memset(&priority_ring, 0, sizeof(priority_ring));
+    memset(&stats, 0, sizeof(stats));
+    memset(class_stats, 0, sizeof(class_stats));
+
+    ram_ring.ram = malloc(config->size);
+    if (!ram_ring.ram) {
+        WPRINT_LIB_INFO(("Unable to allocate the outbound queue\n"));
+        return WICED_OUT_OF_HEAP_SPACE;
+    }
+    ram_ring.capacity = config->size;
+    if (config->priority_size) {
+        priority_ring.ram = malloc(config->priority_size);
+        if (!priority_ring.ram) {
+            WPRINT_LIB_INFO(("Unable to allocate the priority queue\n"));
+            free(ram_ring.ram);
+            ram_ring.ram = NULL;
+            return WICED_OUT_OF_HEAP_SPACE;
+        }
+        priority_ring.capacity = config->priority_size;
+    }
+    if (config->spill_storage && config->spill_storage->read && config->spill_storage->write) {
+        // spilled messages are not preserved across reboots
+        spill_ring.nv = config->spill_storage;
+        spill_ring.capacity = config->spill_storage->size;
+    }
+    drop_policy = config->drop_policy;
+    wiced_rtos_init_mutex(&mutex);
+    is_initialized = true;
+    return WICED_SUCCESS;
+}
+
+void iotc_outbound_queue_deinit(void) {
+    if (!is_initialized) {
+        return;
+    }
+    wiced_rtos_lock_mutex(&mutex);
+    is_initialized = false;
+    wiced_rtos_unlock_mutex(&mutex);
+
+    // nothing uses the queue anymore. Let the owners of the remaining messages know that they won't be sent
+    OqRing *rings[] = {&priority_ring, &ram_ring, &spill_ring};
+    for (size_t i = 0; i < sizeof(rings) / sizeof(rings[0]); i++) {
+        OqRecordHeader header;
+        while (rings[i]->count > 0 && ring_peek(rings[i], &header)) {
+            ring_pop(rings[i], &header);
+            notify_dropped(&header);
+        }
+    }
+    wiced_rtos_deinit_mutex(&mutex);
+    free(ram_ring.ram);
+    free(priority_ring.ram);
+    memset(&ram_ring, 0, sizeof(ram_ring));
+    memset(&spill_ring, 0, sizeof(spill_ring));
+    memset(&priority_ring, 0, sizeof(priority_ring));
+}
+
+bool iotc_outbound_queue_is_initialized(void) {
+    return is_initialized;
+}
+
+wiced_result_t iotc_outbound_queue_push(const uint8_t *data, size_t len, uint32_t expiry_ms,
+                                        wiced_mqtt_qos_level_t qos, uint8_t flags, IotconnectSendPriority priority,
+                                        IotconnectPublishCallback cb, void *ctx) {
+    if (!is_initialized) {
+        return WICED_NOTUP;
+    }
+    if (priority == IOTC_PRIORITY_HIGH && !priority_ring.capacity) {
+        priority = IOTC_PRIORITY_NORMAL; // no separate queue. Keep the order with the rest
+    }
+    if (priority == IOTC_PRIORITY_HIGH ? record_size(len) > priority_ring.capacity
+                                       : record_size(len) > ram_ring.capacity
+                                         && record_size(len) > spill_ring.capacity) {
+        return WICED_BADARG;
+    }
+    OqRecordHeader header = {.qos = (uint8_t) qos, .flags = flags, .cb = cb, .ctx = ctx};
+    wiced_time_t now;
+    wiced_time_get_time(&now);
+    header.queued_at = now;
+    if (expiry_ms) {
+        header.expires_at = now + expiry_ms;
+        if (0 == header.expires_at) {
+            header.expires_at = 1; // 0 means "never"
+        }
+    }
+
+    wiced_result_t ret = WICED_SUCCESS;
+    OqRecordHeader dropped;
+    wiced_rtos_lock_mutex(&mutex);
+    bool pushed = push_in_order(data, len, &header, priority);
+    while (!pushed && drop_policy == IOTC_QUEUE_DROP_OLDEST && drop_oldest(priority, &dropped)) {
+        wiced_rtos_unlock_mutex(&mutex);
+        notify_dropped(&dropped);
+        wiced_rtos_lock_mutex(&mutex);
+        pushed = push_in_order(data, len, &header, priority);
+    }
+    if (pushed) {
+        stats.queued++;
+    } else {
+        stats.dropped_overflow++;
+        class_stats[priority].dropped++;
+        ret = WICED_OUT_OF_HEAP_SPACE;
+    }
+    wiced_rtos_unlock_mutex(&mutex);
+    return ret;
+}
+
+bool iotc_outbound_queue_is_empty(void) {
+    return !is_initialized || (0 == ram_ring.count && 0 == spill_ring.count && 0 == priority_ring.count);
+}
+
+bool iotc_outbound_queue_is_clear_for(IotconnectSendPriority priority) {
+    if (priority == IOTC_PRIORITY_HIGH && priority_ring.capacity) {
+        return !is_initialized || 0 == priority_ring.count;
+    }
+    return iotc_outbound_queue_is_empty();
+}
+
+uint32_t iotc_outbound_queue_drain(IotcOutboundQueueSendFn send_fn) {
+    uint32_t num_sent = 0;
+    if (!is_initialized) {
+        return 0;
+    }
+    wiced_rtos_lock_mutex(&mutex);
+    if (sending) {
+        // another drain is sending. It keeps going until the queue is empty, in order
+        wiced_rtos_unlock_mutex(&mutex);
+        return 0;
+    }
+    while (ram_ring.count > 0 || spill_ring.count > 0 || priority_ring.count > 0) {
+        // strict priority. Checked before every message, so that messages queued during the drain go first
+        OqRing *r = priority_ring.count > 0 ? &priority_ring : ram_ring.count > 0 ? &ram_ring : &spill_ring;
+        OqRecordHeader header;
+        if (!ring_peek(r, &header)) {
+            break;
+        }
+        wiced_time_t now;
+        wiced_time_get_time(&now);
+        if (is_expired(header.expires_at, now)) {
+            ring_pop(r, &header);
+            stats.dropped_expired++;
+            class_stats[ring_priority(r)].dropped++;
+            wiced_rtos_unlock_mutex(&mutex);
+            notify_dropped(&header);
+            wiced_rtos_lock_mutex(&mutex);
+            continue;
+        }
+
+        uint8_t *data;
+        if (r->ram) {
+            data = &r->ram[r->head + sizeof(header)];
+        } else {
+            data = malloc(header.len);
+            if (!data || !ring_read(r, r->head + sizeof(header), data, header.len)) {
+                free(data);
+                break;
+            }
+        }
+        // send without the lock, so that producers are not held up by the network
+        sending = r;
+        wiced_rtos_unlock_mutex(&mutex);
+        bool sent = send_fn(data, header.len, (wiced_mqtt_qos_level_t) header.qos, header.flags, header.cb,
+                            header.ctx);
+        wiced_rtos_lock_mutex(&mutex);
+        sending = NULL;
+        if (!r->ram) {
+            free(data);
+        }
+        if (!sent) {
+            break;
+        }
+        ring_pop(r, &header);
+        stats.sent++;
+        num_sent++;
+        IotconnectPriorityStats *cs = &class_stats[ring_priority(r)];
+        uint32_t wait = now - header.queued_at;
+        cs->sent_queued++;
+        cs->total_wait_ms += wait;
+        if (wait > cs->max_wait_ms) {
+            cs->max_wait_ms = wait;
+        }
+        if (r == &ram_ring && 0 == ram_ring.count) {
+            migrate_spilled();
+        }
+    }
+    wiced_rtos_unlock_mutex(&mutex);
+    return num_sent;
+}
+
+void iotc_outbound_queue_get_stats(IotconnectQueueStats *s) {
+    if (!s) {
+        return;
+    }
+    if (!is_initialized) {
+        memset(s, 0, sizeof(IotconnectQueueStats));
+        return;
+    }
+    wiced_rtos_lock_mutex(&mutex);
+    *s = stats;
+    s->depth = ram_ring.count + spill_ring.count + priority_ring.count;
+    s->spilled = spill_ring.count;
+    wiced_rtos_unlock_mutex(&mutex);
+}
+
+void iotc_outbound_queue_get_priority_stats(IotconnectSendPriority priority, IotconnectPriorityStats *s) {
+    if (!s || priority >= IOTC_PRIORITY_NUM) {
+        return;
+    }
+    if (!is_initialized) {
+        memset(s, 0, sizeof(IotconnectPriorityStats));
+        return;
+    }
+    wiced_rtos_lock_mutex(&mutex);
+    *s = class_stats[priority];
+    s->depth = priority == IOTC_PRIORITY_HIGH ? priority_ring.count : ram_ring.count + spill_ring.count;
+    wiced_rtos_unlock_mutex(&mutex);
+}
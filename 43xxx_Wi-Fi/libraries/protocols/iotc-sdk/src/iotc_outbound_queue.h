@@ -0,0 +1,65 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#pragma once
+
+#include <wiced.h>
+#include "iotc_sdk.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bounded FIFO for outbound messages that could not be sent right away.
+// Messages are kept in a RAM ring and, once the ring is full, optionally spilled into non-volatile storage.
+// The order of messages is preserved across both. High priority messages have a RAM ring of their own,
+// which is drained first.
+
+typedef struct {
+    uint32_t size; // size of the RAM ring in bytes
+    IotconnectQueueDropPolicy drop_policy;
+    IotconnectNvStorage *spill_storage; // optional
+    uint32_t priority_size; // size of the RAM ring for IOTC_PRIORITY_HIGH messages. 0: they share the normal queue
+} IotcOutboundQueueConfig;
+
+// Returns true if the message was handed off to the network
+typedef bool (*IotcOutboundQueueSendFn)(const uint8_t *data, size_t len, wiced_mqtt_qos_level_t qos, uint8_t flags,
+                                        IotconnectPublishCallback cb, void *ctx);
+
+wiced_result_t iotc_outbound_queue_init(const IotcOutboundQueueConfig *config);
+
+// Calls the callbacks of the messages that are still queued with an error
+void iotc_outbound_queue_deinit(void);
+
+bool iotc_outbound_queue_is_initialized(void);
+
+// Copies the message into the queue. expiry_ms of 0 means that the message never expires.
+// Returns WICED_OUT_OF_HEAP_SPACE if the message was dropped according to the drop policy.
+// The message being sent by a drain is never dropped to make room.
+// flags are passed to the send function as they are.
+// cb is stored along with the message and is called with an error if the message is dropped later.
+wiced_result_t iotc_outbound_queue_push(const uint8_t *data, size_t len, uint32_t expiry_ms,
+                                        wiced_mqtt_qos_level_t qos, uint8_t flags, IotconnectSendPriority priority,
+                                        IotconnectPublishCallback cb, void *ctx);
+
+bool iotc_outbound_queue_is_empty(void);
+
+// True if nothing is queued that would have to be sent before a message of the given priority
+bool iotc_outbound_queue_is_clear_for(IotconnectSendPriority priority);
+
+// Sends queued messages in order with send_fn until the queue is empty or send_fn fails.
+// Expired messages are discarded. Returns the number of sent messages.
+// send_fn and the callbacks of dropped messages are called without the queue lock held, so they may push.
+// Returns 0 right away if another drain is in progress.
+uint32_t iotc_outbound_queue_drain(IotcOutboundQueueSendFn send_fn);
+
+void iotc_outbound_queue_get_stats(IotconnectQueueStats *stats);
+
+// sent_direct is not known to the queue and is left at 0
+void iotc_outbound_queue_get_priority_stats(IotconnectSendPriority priority, IotconnectPriorityStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,256 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "iotc_publisher.h"
+
+// The writer publishes, compresses and drains the queue, but discovery and TLS handshakes never run on it
+#ifndef IOTC_SDK_PUBLISHER_STACK_SIZE
+#define IOTC_SDK_PUBLISHER_STACK_SIZE 4096
+#endif
+
+#ifndef IOTC_SDK_PUBLISHER_PRIORITY
+#define IOTC_SDK_PUBLISHER_PRIORITY WICED_DEFAULT_LIBRARY_PRIORITY
+#endif
+
+// Lets the host stress test widen the window between reading enqueue_pos and claiming it,
+// so that producers collide even on a single core
+#ifndef IOTC_PUBLISHER_CLAIM_DELAY
+#define IOTC_PUBLISHER_CLAIM_DELAY()
+#endif
+
+// A slot is free for the producer that claims position p when its sequence is p,
+// and holds a message for the writer when its sequence is p + 1
+typedef struct {
+    volatile uint32_t sequence;
+    IotcPublishRecord record; // data is NULL if the heap copy failed after the slot was claimed
+} PublisherSlot;
+
+static PublisherSlot *slots = NULL;
+static uint8_t *storage = NULL; // slot_size bytes per slot
+static uint32_t slot_size;
+static uint32_t mask;
+static volatile uint32_t enqueue_pos = 0; // claimed by producers with a compare-and-swap
+static uint32_t dequeue_pos = 0; // writer only
+static IotcPublisherHandler handler;
+static IotcPublisherIdleFn idle_fn;
+static bool has_thread = false;
+static volatile bool stopping = false; // the writer thread exits once the ring is empty
+static wiced_thread_t thread;
+static wiced_semaphore_t wakeup;
+static IotconnectPublisherStats stats;
+
+#define MEMORY_BARRIER() __sync_synchronize()
+
+static void record_depth(uint32_t depth) {
+    uint32_t max = stats.max_depth;
+    while (depth > max) {
+        uint32_t prev = __sync_val_compare_and_swap(&stats.max_depth, max, depth);
+        if (prev == max) {
+            break;
+        }
+        max = prev;
+    }
+}
+
+uint32_t iotc_publisher_process(uint32_t max_messages) {
+    uint32_t num_handled = 0;
+    if (!slots) {
+        return 0;
+    }
+    while (num_handled < max_messages) {
+        PublisherSlot *slot = &slots[dequeue_pos & mask];
+        if ((int32_t) (slot->sequence - (dequeue_pos + 1)) < 0) {
+            break; // empty, or the producer has not finished copying yet
+        }
+        MEMORY_BARRIER();
+        IotcPublishRecord *record = &slot->record;
+        if (record->data) {
+            wiced_time_t now;
+            wiced_time_get_time(&now);
+            uint32_t latency = now - record->enqueued_at;
+            stats.total_latency_ms += latency;
+            if (latency > stats.max_latency_ms) {
+                stats.max_latency_ms = latency;
+            }
+            handler(record);
+            stats.processed++;
+        }
+        if (record->len > slot_size) {
+            free(record->data);
+        }
+        MEMORY_BARRIER();
+        // the slot storage is only handed back to producers once the handler is done with it
+        slot->sequence = dequeue_pos + mask + 1;
+        dequeue_pos++;
+        num_handled++;
+    }
+    return num_handled;
+}
+
+static void publisher_thread(wiced_thread_arg_t arg) {
+    (void) arg;
+    uint32_t timeout = WICED_NEVER_TIMEOUT;
+    while (!stopping) {
+        (void) wiced_rtos_get_semaphore(&wakeup, timeout);
+        while (iotc_publisher_process(UINT32_MAX) > 0) {
+        }
+        uint32_t next = idle_fn ? idle_fn() : UINT32_MAX;
+        timeout = (UINT32_MAX == next) ? WICED_NEVER_TIMEOUT : next;
+    }
+}
+
+wiced_result_t iotc_publisher_init(uint32_t num_slots, uint32_t _slot_size, bool own_thread,
+                                   IotcPublisherHandler _handler, IotcPublisherIdleFn _idle_fn) {
+    if (slots) {
+        return WICED_SUCCESS;
+    }
+    if (0 == num_slots || 0 == _slot_size || !_handler) {
+        return WICED_BADARG;
+    }
+    uint32_t capacity = 1;
+    while (capacity <= num_slots / 2) {
+        capacity *= 2;
+    }
+    PublisherSlot *s = calloc(capacity, sizeof(PublisherSlot));
+    uint8_t *st = malloc(capacity * _slot_size);
+    if (!s || !st) {
+        WPRINT_LIB_INFO(("Unable to allocate the publisher queue\n"));
+        free(s);
+        free(st);
+        return WICED_OUT_OF_HEAP_SPACE;
+    }
+    for (uint32_t i = 0; i < capacity; i++) {
+        s[i].sequence = i;
+    }
+    mask = capacity - 1;
+    slot_size = _slot_size;
+    storage = st;
+    enqueue_pos = dequeue_pos = 0;
+    handler = _handler;
+    idle_fn = _idle_fn;
+    memset(&stats, 0, sizeof(stats));
+
+    if (own_thread) {
+        wiced_rtos_init_semaphore(&wakeup);
+        wiced_result_t ret = wiced_rtos_create_thread(&thread, IOTC_SDK_PUBLISHER_PRIORITY, "iotc-publisher",
+                                                      publisher_thread, IOTC_SDK_PUBLISHER_STACK_SIZE, NULL);
+        if (WICED_SUCCESS != ret) {
+            WPRINT_LIB_INFO(("Unable to create the publisher thread\n"));
+            wiced_rtos_deinit_semaphore(&wakeup);
+            free(s);
+            free(st);
+            storage = NULL;
+            return ret;
+        }
+        has_thread = true;
+    }
+    MEMORY_BARRIER();
+    slots = s;
+    return WICED_SUCCESS;
+}
+
+void iotc_publisher_deinit(void) {
+    if (!slots) {
+        return;
+    }
+    if (has_thread) {
+        stopping = true;
+        MEMORY_BARRIER();
+        (void) wiced_rtos_set_semaphore(&wakeup);
+        wiced_rtos_thread_join(&thread);
+        wiced_rtos_delete_thread(&thread);
+        wiced_rtos_deinit_semaphore(&wakeup);
+        has_thread = false;
+        stopping = false;
+    } else {
+        while (iotc_publisher_process(UINT32_MAX) > 0) {
+        }
+    }
+    PublisherSlot *s = slots;
+    slots = NULL;
+    MEMORY_BARRIER();
+    free(s);
+    free(storage);
+    storage = NULL;
+}
+
+bool iotc_publisher_is_enabled(void) {
+    return NULL != slots;
+}
+
+wiced_result_t iotc_publisher_push(const uint8_t *data, size_t len, const IotconnectSendOptions *options) {
+    if (!slots) {
+        return WICED_NOTUP;
+    }
+
+    PublisherSlot *slot;
+    uint32_t pos = enqueue_pos;
+    for (;;) {
+        slot = &slots[pos & mask];
+        int32_t diff = (int32_t) (slot->sequence - pos);
+        IOTC_PUBLISHER_CLAIM_DELAY();
+        if (0 == diff) {
+            uint32_t prev = __sync_val_compare_and_swap(&enqueue_pos, pos, pos + 1);
+            if (prev == pos) {
+                break;
+            }
+            pos = prev; // another producer claimed it first
+            __sync_fetch_and_add(&stats.contended, 1);
+        } else if (diff < 0) {
+            // the writer has not released this slot yet
+            __sync_fetch_and_add(&stats.rejected, 1);
+            return WICED_OUT_OF_HEAP_SPACE;
+        } else {
+            pos = enqueue_pos;
+            __sync_fetch_and_add(&stats.contended, 1);
+        }
+    }
+
+    // the writer waits for the copy, so the claimed slot is filled without delay. Only a large message allocates.
+    uint8_t *copy = len <= slot_size ? &storage[(pos & mask) * slot_size] : malloc(len);
+    if (copy) {
+        memcpy(copy, data, len);
+    }
+    slot->record.data = copy;
+    slot->record.len = len;
+    slot->record.has_options = (NULL != options);
+    if (options) {
+        slot->record.options = *options;
+    }
+    wiced_time_get_time(&slot->record.enqueued_at);
+    MEMORY_BARRIER();
+    slot->sequence = pos + 1; // published even without a copy, as the writer can't skip a claimed slot
+    if (!copy) {
+        __sync_fetch_and_add(&stats.rejected, 1);
+        iotc_publisher_wake();
+        return WICED_OUT_OF_HEAP_SPACE;
+    }
+
+    __sync_fetch_and_add(&stats.enqueued, 1);
+    // dequeue_pos may be stale here, which would overstate the depth
+    uint32_t depth = pos + 1 - dequeue_pos;
+    record_depth(depth > mask + 1 ? mask + 1 : depth);
+    iotc_publisher_wake();
+    return WICED_SUCCESS;
+}
+
+void iotc_publisher_wake(void) {
+    if (has_thread) {
+        (void) wiced_rtos_set_semaphore(&wakeup);
+    }
+}
+
+bool iotc_publisher_is_empty(void) {
+    return !slots || enqueue_pos == dequeue_pos;
+}
+
+void iotc_publisher_get_stats(IotconnectPublisherStats *s) {
+    if (s) {
+        *s = stats;
+        s->depth = slots ? enqueue_pos - dequeue_pos : 0;
+    }
+}
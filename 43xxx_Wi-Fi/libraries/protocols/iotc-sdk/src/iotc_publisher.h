@@ -0,0 +1,63 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#pragma once
+
+#include <wiced.h>
+#include "iotc_sdk.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Hands outbound messages from any number of application threads to a single writer, so that the MQTT client,
+// the outbound queue and the coalescer are only ever used from one thread.
+// Producers claim a slot of a bounded ring with a compare-and-swap and never wait for the network or a lock.
+
+typedef struct {
+    uint8_t *data; // copy in the slot, or on the heap if it didn't fit. Only valid until the handler returns
+    size_t len;
+    bool has_options;
+    IotconnectSendOptions options;
+    wiced_time_t enqueued_at;
+} IotcPublishRecord;
+
+// Called on the writer for each message, in the order the messages were claimed
+typedef void (*IotcPublisherHandler)(const IotcPublishRecord *record);
+
+// Called on the writer after each wakeup, for work of its own. Returns the time in ms until it needs to be called
+// again, or UINT32_MAX.
+typedef uint32_t (*IotcPublisherIdleFn)(void);
+
+// num_slots is rounded down to a power of two. Each slot has slot_size bytes of storage, allocated with the ring,
+// so that pushing a message of up to slot_size bytes doesn't allocate. Without own_thread, the messages are
+// processed by iotc_publisher_process on the caller's thread.
+wiced_result_t iotc_publisher_init(uint32_t num_slots, uint32_t slot_size, bool own_thread,
+                                   IotcPublisherHandler handler, IotcPublisherIdleFn idle_fn);
+
+// Processes the messages that are still in the ring, stops the writer thread and frees the ring, so that the next
+// init applies its own config. Producers must have stopped pushing.
+void iotc_publisher_deinit(void);
+
+bool iotc_publisher_is_enabled(void);
+
+// Copies the message into a free slot. A message larger than the slot is copied to the heap instead.
+// Safe to call from any thread. Returns WICED_OUT_OF_HEAP_SPACE if the ring is full or the heap copy
+// can't be allocated.
+wiced_result_t iotc_publisher_push(const uint8_t *data, size_t len, const IotconnectSendOptions *options);
+
+// Has the writer thread call idle_fn soon
+void iotc_publisher_wake(void);
+
+// For the writer without own_thread. Returns the number of handled messages.
+uint32_t iotc_publisher_process(uint32_t max_messages);
+
+bool iotc_publisher_is_empty(void);
+
+void iotc_publisher_get_stats(IotconnectPublisherStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,158 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#include <string.h>
+#include "iotc_rate_limit.h"
+
+// The balance is kept in token-milliseconds per minute, so that refilling needs no division:
+// every elapsed millisecond adds rate_per_min units and a token is worth 60000 units.
+#define UNITS_PER_TOKEN 60000
+
+static uint32_t rate_per_min = 0; // 0 if disabled
+static int64_t capacity;
+static int64_t balance;
+static wiced_time_t last_refill;
+static IotconnectRateLimitPolicy policy;
+static uint32_t block_timeout_ms;
+static IotconnectRateLimitStats stats;
+static wiced_mutex_t mutex;
+
+static void refill(void) {
+    wiced_time_t now;
+    wiced_time_get_time(&now);
+    balance += (int64_t) (uint32_t) (now - last_refill) * rate_per_min;
+    if (balance > capacity) {
+        balance = capacity;
+    }
+    last_refill = now;
+}
+
+// Must be called with mutex held, after refill
+static uint32_t wait_for_token_ms(void) {
+    if (balance >= UNITS_PER_TOKEN) {
+        return 0;
+    }
+    return (uint32_t) ((UNITS_PER_TOKEN - balance + rate_per_min - 1) / rate_per_min);
+}
+
+wiced_result_t iotc_rate_limit_init(uint32_t rate, uint32_t burst, IotconnectRateLimitPolicy _policy,
+                                    uint32_t _block_timeout_ms) {
+    if (rate_per_min) {
+        return WICED_SUCCESS;
+    }
+    if (!rate || !burst) {
+        return WICED_BADARG;
+    }
+    capacity = (int64_t) burst * UNITS_PER_TOKEN;
+    balance = capacity; // start with a full bucket
+    policy = _policy;
+    block_timeout_ms = _block_timeout_ms;
+    memset(&stats, 0, sizeof(stats));
+    wiced_time_get_time(&last_refill);
+    wiced_rtos_init_mutex(&mutex);
+    rate_per_min = rate;
+    return WICED_SUCCESS;
+}
+
+void iotc_rate_limit_deinit(void) {
+    if (!rate_per_min) {
+        return;
+    }
+    rate_per_min = 0;
+    wiced_rtos_deinit_mutex(&mutex);
+}
+
+bool iotc_rate_limit_is_enabled(void) {
+    return 0 != rate_per_min;
+}
+
+wiced_result_t iotc_rate_limit_acquire(void) {
+    uint32_t waited = 0;
+    if (!rate_per_min) {
+        return WICED_SUCCESS;
+    }
+    wiced_rtos_lock_mutex(&mutex);
+    for (;;) {
+        refill();
+        uint32_t wait = wait_for_token_ms();
+        if (0 == wait) {
+            balance -= UNITS_PER_TOKEN;
+            stats.allowed++;
+            if (waited) {
+                stats.delayed++;
+                stats.total_delay_ms += waited;
+            }
+            wiced_rtos_unlock_mutex(&mutex);
+            return WICED_SUCCESS;
+        }
+        if (policy != IOTC_RATE_LIMIT_BLOCK) {
+            wiced_rtos_unlock_mutex(&mutex);
+            return WICED_WOULD_BLOCK;
+        }
+        if (waited >= block_timeout_ms) {
+            stats.timed_out++;
+            wiced_rtos_unlock_mutex(&mutex);
+            return WICED_TIMEOUT;
+        }
+        if (wait > block_timeout_ms - waited) {
+            wait = block_timeout_ms - waited;
+        }
+        // other senders may take the token meanwhile, in which case we wait again
+        wiced_rtos_unlock_mutex(&mutex);
+        wiced_rtos_delay_milliseconds(wait);
+        waited += wait;
+        wiced_rtos_lock_mutex(&mutex);
+    }
+}
+
+void iotc_rate_limit_record_throttled(bool aggregated) {
+    if (!rate_per_min) {
+        return;
+    }
+    wiced_rtos_lock_mutex(&mutex);
+    if (aggregated) {
+        stats.aggregated++;
+    } else {
+        stats.dropped++;
+    }
+    wiced_rtos_unlock_mutex(&mutex);
+}
+
+void iotc_rate_limit_charge(void) {
+    if (!rate_per_min) {
+        return;
+    }
+    wiced_rtos_lock_mutex(&mutex);
+    refill();
+    balance -= UNITS_PER_TOKEN;
+    stats.allowed++;
+    wiced_rtos_unlock_mutex(&mutex);
+}
+
+uint32_t iotc_rate_limit_next_token_ms(void) {
+    if (!rate_per_min) {
+        return 0;
+    }
+    wiced_rtos_lock_mutex(&mutex);
+    refill();
+    uint32_t wait = wait_for_token_ms();
+    wiced_rtos_unlock_mutex(&mutex);
+    return wait;
+}
+
+void iotc_rate_limit_get_stats(IotconnectRateLimitStats *s) {
+    if (!s) {
+        return;
+    }
+    if (!rate_per_min) {
+        memset(s, 0, sizeof(IotconnectRateLimitStats));
+        return;
+    }
+    wiced_rtos_lock_mutex(&mutex);
+    refill();
+    *s = stats;
+    s->tokens = balance > 0 ? (uint32_t) (balance / UNITS_PER_TOKEN) : 0;
+    wiced_rtos_unlock_mutex(&mutex);
+}
@@ -0,0 +1,43 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#pragma once
+
+#include <wiced.h>
+#include "iotc_sdk.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Token bucket that refills at rate_per_min tokens per minute and holds up to burst tokens.
+// Every message takes one token. Messages that must not be limited can still be charged, which may leave
+// the bucket in debt, so that the following messages wait until the average rate is met again.
+
+wiced_result_t iotc_rate_limit_init(uint32_t rate_per_min, uint32_t burst, IotconnectRateLimitPolicy policy,
+                                    uint32_t block_timeout_ms);
+
+void iotc_rate_limit_deinit(void);
+
+bool iotc_rate_limit_is_enabled(void);
+
+// Takes a token. With IOTC_RATE_LIMIT_BLOCK, waits up to block_timeout_ms for one and returns WICED_TIMEOUT
+// if none became available. With the other policies, returns WICED_WOULD_BLOCK right away if there is no token,
+// and the caller should drop or aggregate the message and report it with iotc_rate_limit_record_throttled.
+wiced_result_t iotc_rate_limit_acquire(void);
+
+void iotc_rate_limit_record_throttled(bool aggregated);
+
+// Takes a token even if there is none
+void iotc_rate_limit_charge(void);
+
+// Time until the next token is available. 0 if one is available now.
+uint32_t iotc_rate_limit_next_token_ms(void);
+
+void iotc_rate_limit_get_stats(IotconnectRateLimitStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -4,17 +4,91 @@
 
 #include "iotc_wiced_discovery.h"
 #include "iotc_wiced_mqtt.h"
+#include "iotc_sr_cache.h"
+#include "iotc_sr_arena.h"
+#include "iotc_outbound_queue.h"
+#include "iotc_topic_dispatch.h"
+#include "iotc_tls_session.h"
+#include "iotc_keepalive.h"
+#include "iotc_coalesce.h"
+#include "iotc_compress.h"
+#include "iotc_rate_limit.h"
+#include "iotc_interval.h"
+#include "iotc_dedup.h"
+#include "iotc_inbound_queue.h"
+#include "iotc_publisher.h"
+#include "iotc_worker.h"
+#include "iotconnect_telemetry.h"
 #include "iotc_sdk.h"
 #include "iotconnect_client_config.h"
 
 #define IOTC_SDK_DEFAULT_NUM_DISCOVERY_TRIES 3
+#define IOTC_SDK_DEFAULT_SR_CACHE_TTL_SECS (24 * 60 * 60)
+#define IOTC_SDK_DEFAULT_COALESCE_DELAY_MS 1000
+#define IOTC_SDK_DEFAULT_PRIORITY_QUEUE_SIZE 1024
+#define IOTC_SDK_DEFAULT_RATE_LIMIT_BLOCK_TIMEOUT_MS 10000
+#define IOTC_SDK_DEFAULT_TELEMETRY_INTERVAL_MIN_MS 5000
+#define IOTC_SDK_DEFAULT_INBOUND_QUEUE_SIZE 4096
+#define IOTC_SDK_DEFAULT_INBOUND_BLOCK_TIMEOUT_MS 1000
+#define IOTC_SDK_DEFAULT_PUBLISHER_SLOT_SIZE 256
 
+// How often the link is evaluated to adapt the telemetry interval
+#ifndef IOTC_SDK_INTERVAL_EVAL_MS
+#define IOTC_SDK_INTERVAL_EVAL_MS 5000
+#endif
 
-IotclSyncResponse *sync_response = NULL;
+// Size of the message that records over the rate limit are merged into, if coalescing is not configured
+#ifndef IOTC_SDK_RATE_LIMIT_AGGREGATE_SIZE
+#define IOTC_SDK_RATE_LIMIT_AGGREGATE_SIZE 2048
+#endif
+
+// Inbound messages processed per worker event, so that init steps are not held back by a burst
+#ifndef IOTC_SDK_INBOUND_BATCH
+#define IOTC_SDK_INBOUND_BATCH 8
+#endif
+
+
+IotclSyncResponse *sync_response = NULL; // packed with iotc_sr_arena_pack. mqtt_config.sr points to it
 
 static IotconnectClientConfig config;
 static IotclConfig lib_config;
+// Held while the dtg and the lib config change, and by iotconnect_sdk_telemetry_create which reads them
+static wiced_mutex_t lib_config_mutex;
+static bool lib_config_mutex_initialized = false;
 static IotconnectMqttConfig mqtt_config;
+static IotcMqttClient *mqtt_client = NULL;
+// Callers, the publisher thread, the coalescer timer and the queue drain use mqtt_client between client_enter and
+// client_exit. apply_sync_response pauses them before it replaces the client.
+static volatile uint32_t client_users = 0;
+static volatile bool client_paused = false;
+static IotcKeepalive keepalive; // kept across connects, so that a learned interval is reused
+static bool is_initialized = false; // init completed and the queue can be drained
+
+static IotconnectInboundStats inbound_stats;
+
+// topics of registered handlers that are not covered by the devicebound subscription
+static char *extra_subscriptions[IOTC_SDK_MAX_TOPIC_HANDLERS];
+
+static char *compressed_pub_topic = NULL;
+
+static uint32_t sent_direct[IOTC_PRIORITY_NUM];
+
+static wiced_timed_event_t interval_event;
+static bool link_evaluation_active = false;
+static wiced_time_t link_evaluation_at; // poll mode only
+
+typedef enum {
+    INIT_IDLE,
+    INIT_RESOLVE, // load the sync response from the cache or run discovery
+    INIT_CONNECT,
+    INIT_FINISH
+} InitState;
+
+static InitState init_state = INIT_IDLE;
+static bool init_from_cache = false; // sync_response came from the cache
+static volatile bool revalidate_pending = false; // poll mode: discovery runs on the next iotconnect_sdk_loop
+static wiced_worker_thread_t *sdk_worker = NULL; // acquired on first init and kept afterwards
+static volatile bool inbound_scheduled = false; // an inbound processing event is pending on sdk_worker
 
 static void report_sync_error(IotclSyncResponse *response) {
     if (NULL == response) {
@@ -56,49 +130,665 @@ static void report_sync_error(IotclSyncResponse *response) {
     }
 }
 
-static void on_iotconnect_status(IotconnectConnectionStatus status, void *data) {
+// Returns false while the client is being replaced. Messages are queued meanwhile, as if disconnected.
+// On true, mqtt_client and compressed_pub_topic stay valid until client_exit.
+static bool client_enter() {
+    __sync_fetch_and_add(&client_users, 1); // a full barrier, so the flag is read after the count is visible
+    if (client_paused) {
+        __sync_fetch_and_sub(&client_users, 1);
+        return false;
+    }
+    return true;
+}
+
+static void client_exit() {
+    __sync_fetch_and_sub(&client_users, 1);
+}
+
+// The users never wait for this thread, so this waits for at most one publish
+static void client_pause() {
+    client_paused = true;
+    __sync_synchronize();
+    while (client_users > 0) {
+        wiced_rtos_delay_milliseconds(1);
+    }
+}
+
+static void client_resume() {
+    __sync_synchronize();
+    client_paused = false;
+}
+
+static volatile bool drain_pending = false;
+static volatile bool flush_requested = false; // publisher mode: iotconnect_sdk_flush was called
+
+static bool queue_send(const uint8_t *data, size_t len, wiced_mqtt_qos_level_t qos, uint8_t flags,
+                       IotconnectPublishCallback cb, void *ctx) {
+    return 0 != iotc_wiced_mqtt_publish(mqtt_client, data, len, qos, flags, cb, ctx);
+}
+
+static wiced_result_t drain_queue(void *arg) {
+    (void) arg;
+    drain_pending = false;
+    if (!client_enter()) {
+        return WICED_SUCCESS; // drained again once the new client is up
+    }
+    uint32_t num_sent = iotc_outbound_queue_drain(queue_send);
+    client_exit();
+    if (num_sent > 0) {
+        WPRINT_LIB_INFO(("Sent %lu queued messages\n", (unsigned long) num_sent));
+    }
+    return WICED_SUCCESS;
+}
+
+static void schedule_queue_drain() {
+    if (drain_pending || iotc_outbound_queue_is_empty()) {
+        return;
+    }
+    drain_pending = true;
+    if (iotc_publisher_is_enabled()) {
+        iotc_publisher_wake(); // the publisher thread is the only one that publishes
+        return;
+    }
+    if (config.poll_mode) {
+        return; // iotconnect_sdk_loop drains it
+    }
+    // don't publish from the MQTT event callback
+    if (WICED_SUCCESS != wiced_rtos_send_asynchronous_event(sdk_worker, drain_queue, NULL)) {
+        drain_pending = false;
+        WPRINT_LIB_INFO(("Warning: Unable to schedule the outbound queue drain\n"));
+    }
+}
+
+static void on_iotconnect_status(IotconnectConnectionStatus status, void *data, void *ctx) {
+    (void) ctx;
+    // a PUBACK frees a slot in the in-flight window, so the queue may continue
+    if ((status == MQTT_CONNECTED || status == MQTT_PUBLISHED) && is_initialized) {
+        schedule_queue_drain();
+    }
     if (config.status_cb) {
         config.status_cb(status, data);
     }
 }
 
-void iotconnect_sdk_disconnect() {
-    iotcl_discovery_free_sync_response(sync_response);
-    sync_response = NULL;
-    iotc_wiced_mqtt_disconnect();
-    iotc_wiced_mqtt_deinit();
+static wiced_result_t evaluate_link(void *arg) {
+    (void) arg;
+    IotconnectPublishStats publish_stats = {0};
+    IotconnectReconnectStats reconnect_stats = {0};
+    IotconnectQueueStats queue_stats;
+    if (!client_enter()) {
+        return WICED_SUCCESS;
+    }
+    iotc_wiced_mqtt_get_publish_stats(mqtt_client, &publish_stats);
+    iotc_wiced_mqtt_get_reconnect_stats(mqtt_client, &reconnect_stats);
+    client_exit();
+    iotc_outbound_queue_get_stats(&queue_stats);
+
+    IotcLinkSample sample = {
+            .acknowledged = publish_stats.acknowledged,
+            .total_latency_ms = publish_stats.total_latency_ms,
+            .retransmits = publish_stats.retransmits,
+            .failed = publish_stats.failed,
+            .disconnects = reconnect_stats.disconnects,
+            .queue_depth = queue_stats.depth
+    };
+    uint32_t previous = iotc_interval_get();
+    uint32_t interval = iotc_interval_update(&sample);
+    if (interval != previous) {
+        WPRINT_LIB_INFO(("Telemetry interval is now %lu ms\n", (unsigned long) interval));
+        if (config.interval_cb) {
+            config.interval_cb(interval, config.interval_ctx);
+        }
+    }
+    return WICED_SUCCESS;
+}
+
+static void start_link_evaluation() {
+    if (!config.telemetry_interval_max_ms || link_evaluation_active) {
+        return;
+    }
+    if (config.poll_mode) {
+        wiced_time_get_time(&link_evaluation_at);
+        link_evaluation_at += IOTC_SDK_INTERVAL_EVAL_MS;
+        link_evaluation_active = true;
+        return;
+    }
+    if (WICED_SUCCESS == wiced_rtos_register_timed_event(&interval_event, sdk_worker, evaluate_link,
+                                                         IOTC_SDK_INTERVAL_EVAL_MS, NULL)) {
+        link_evaluation_active = true;
+    } else {
+        WPRINT_LIB_INFO(("Warning: Unable to schedule the telemetry interval evaluation\n"));
+    }
+}
+
+static void stop_link_evaluation() {
+    if (link_evaluation_active && !config.poll_mode) {
+        wiced_rtos_deregister_timed_event(&interval_event);
+    }
+    if (link_evaluation_active) {
+        link_evaluation_active = false;
+    }
+}
+
+static void use_sync_response(IotclSyncResponse *sr);
+
+// Runs fn on sdk_worker and waits for it, so that it doesn't overlap with an init step, a reconnect or any other
+// SDK work. Without a worker (poll mode) the calling thread does all of the work anyway.
+static wiced_result_t run_on_sdk_worker(event_handler_t fn) {
+    if (!sdk_worker) {
+        return fn(NULL);
+    }
+    return iotc_worker_run(sdk_worker, fn, NULL);
+}
+
+static wiced_result_t disconnect(void *arg) {
+    (void) arg;
+    iotc_publisher_deinit(); // hands the messages it still has to the coalescer and the queue
+    stop_link_evaluation();
+    iotc_coalesce_deinit(); // flushes while still connected
+    is_initialized = false;
+    // like apply_sync_response, wait for a publish or a stats read that is using the client or the queue
+    client_pause();
+    iotc_wiced_mqtt_disconnect(mqtt_client);
+    iotc_wiced_mqtt_destroy(mqtt_client);
+    mqtt_client = NULL;
+    // the next init applies its own config. Messages still queued are dropped.
+    iotc_outbound_queue_deinit();
+    iotc_rate_limit_deinit();
+    iotc_inbound_queue_deinit(); // the client that filled it is gone, and this thread is the one that drains it
+    // the client used it until now
+    if (sync_response) {
+        use_sync_response(NULL);
+    }
+    client_resume(); // senders find no client and no queue from here on, and fail
     WPRINT_LIB_INFO(("SDK Disconnected\n"));
+    return WICED_SUCCESS;
 }
 
-wiced_mqtt_msgid_t iotconnect_sdk_send_packet(const char *data) {
-    wiced_mqtt_msgid_t ret = iotc_wiced_mqtt_publish((uint8_t *) data, strlen(data));
-    if (ret == WICED_SUCCESS) {
-        WPRINT_LIB_INFO(("Error: Failed to publish packet!"));
+void iotconnect_sdk_disconnect() {
+    init_state = INIT_IDLE; // stops a pending async init after its current step
+    // an init step that is running still uses the sync response, so the teardown waits for it
+    (void) run_on_sdk_worker(disconnect);
+}
+
+static wiced_result_t send_or_queue(const uint8_t *data, size_t len, const IotconnectSendOptions *options) {
+    IotconnectPublishCallback cb = options ? options->publish_cb : NULL;
+    void *ctx = options ? options->publish_ctx : NULL;
+    wiced_mqtt_qos_level_t qos = (options && options->qos0) ?
+                                 WICED_MQTT_QOS_DELIVER_AT_MOST_ONCE : WICED_MQTT_QOS_DELIVER_AT_LEAST_ONCE;
+    IotconnectSendPriority priority = options ? options->priority : IOTC_PRIORITY_NORMAL;
+    uint8_t flags = 0;
+    wiced_result_t ret = WICED_SUCCESS;
+
+    if (priority >= IOTC_PRIORITY_NUM) {
+        return WICED_BADARG;
+    }
+    bool have_client = client_enter();
+    if (priority == IOTC_PRIORITY_HIGH) {
+        flags |= IOTC_PUBLISH_FLAG_PRIORITY;
+    }
+
+    // compressed before queueing, so that it takes less queue space as well
+    size_t compressed_len;
+    uint8_t *compressed = (have_client && compressed_pub_topic) ? iotc_compress(data, len, &compressed_len) : NULL;
+    if (compressed) {
+        data = compressed;
+        len = compressed_len;
+        flags |= IOTC_PUBLISH_FLAG_COMPRESSED;
+    }
+
+    // if there's anything queued at the same or higher priority, the message needs to go behind it
+    if (have_client && iotc_outbound_queue_is_clear_for(priority)
+        && 0 != iotc_wiced_mqtt_publish(mqtt_client, data, len, qos, flags, cb, ctx)) {
+        sent_direct[priority]++;
+        goto cleanup;
+    }
+    if (!iotc_outbound_queue_is_initialized()) {
+        WPRINT_LIB_INFO(("Error: Failed to publish packet!\n"));
+        ret = WICED_ERROR;
+        goto cleanup;
+    }
+    uint32_t expiry_ms = (options && options->expiry_ms) ? options->expiry_ms : config.queue_expiry_ms;
+    ret = iotc_outbound_queue_push(data, len, expiry_ms, qos, flags, priority, cb, ctx);
+    if (WICED_SUCCESS != ret) {
+        WPRINT_LIB_INFO(("Error: Outbound queue is full. Packet dropped!\n"));
+        goto cleanup;
+    }
+    if (have_client && iotc_wiced_mqtt_is_connected(mqtt_client)) {
+        schedule_queue_drain();
+    }
+
+    cleanup:
+    if (have_client) {
+        client_exit();
     }
+    free(compressed);
     return ret;
 }
 
-wiced_mqtt_msgid_t iotconnect_sdk_send_data_packet(uint8_t *data, size_t len) {
-    wiced_mqtt_msgid_t ret = iotc_wiced_mqtt_publish(data, len);
-    if (ret == WICED_SUCCESS) {
-        WPRINT_LIB_INFO(("Error: Failed to publish packet!"));
+static wiced_result_t send_batch(const uint8_t *data, size_t len) {
+    // the records were accepted already, so the batch can't be held back. It is charged against the budget instead.
+    iotc_rate_limit_charge();
+    return send_or_queue(data, len, NULL);
+}
+
+static wiced_result_t apply_rate_limit(const uint8_t *data, size_t len, bool plain) {
+    wiced_result_t ret = iotc_rate_limit_acquire();
+    if (WICED_WOULD_BLOCK == ret) {
+        bool aggregated = config.rate_limit_policy == IOTC_RATE_LIMIT_AGGREGATE && plain
+                          && WICED_SUCCESS == iotc_coalesce_add(data, len);
+        iotc_rate_limit_record_throttled(aggregated);
+        if (aggregated) {
+            return WICED_PENDING;
+        }
+        WPRINT_LIB_INFO(("Warning: Message rate limit exceeded. Packet dropped!\n"));
+    } else if (WICED_TIMEOUT == ret) {
+        WPRINT_LIB_INFO(("Warning: Timed out waiting for the message rate limit. Packet dropped!\n"));
     }
     return ret;
 }
 
+static wiced_result_t send_packet_now(const uint8_t *data, size_t len, const IotconnectSendOptions *options) {
+    // only plain QoS1 telemetry is coalesced. A batch can't honor per-message options.
+    bool plain = !options || (!options->publish_cb && !options->qos0 && !options->expiry_ms
+                              && options->priority == IOTC_PRIORITY_NORMAL);
+    // the coalescer may also be there just to aggregate over the rate limit
+    if (plain && config.coalesce_size && WICED_UNSUPPORTED != iotc_coalesce_add(data, len)) {
+        return WICED_SUCCESS;
+    }
+    // a message that bypasses the coalescer must not overtake the records added before it
+    if ((!plain || config.coalesce_size) && iotc_coalesce_is_enabled()) {
+        (void) iotc_coalesce_flush();
+    }
+    if (!options || options->priority == IOTC_PRIORITY_NORMAL) {
+        wiced_result_t ret = apply_rate_limit(data, len, plain);
+        if (WICED_PENDING == ret) {
+            return WICED_SUCCESS; // will be sent with the aggregated records
+        }
+        if (WICED_SUCCESS != ret) {
+            return ret;
+        }
+    } else {
+        iotc_rate_limit_charge();
+    }
+    return send_or_queue(data, len, options);
+}
+
+static void publish_record(const IotcPublishRecord *record) {
+    const IotconnectSendOptions *options = record->has_options ? &record->options : NULL;
+    wiced_result_t ret = send_packet_now(record->data, record->len, options);
+    if (WICED_SUCCESS != ret && options && options->publish_cb) {
+        options->publish_cb(ret, 0, options->publish_ctx);
+    }
+}
+
+// Timer driven work of the thread that publishes: the publisher thread or iotconnect_sdk_loop
+static uint32_t run_publish_work(void) {
+    if (flush_requested) {
+        flush_requested = false;
+        (void) iotc_coalesce_flush();
+    }
+    if (drain_pending && is_initialized) {
+        (void) drain_queue(NULL); // bounded by the in-flight window
+    }
+    uint32_t next = iotc_coalesce_poll();
+    if (client_enter()) {
+        uint32_t due = iotc_wiced_mqtt_check_inflight(mqtt_client);
+        client_exit();
+        next = due < next ? due : next;
+    }
+    return next;
+}
+
+wiced_result_t iotconnect_sdk_send_packet_ex(const uint8_t *data, size_t len, const IotconnectSendOptions *options) {
+    if (iotc_publisher_is_enabled()) {
+        return iotc_publisher_push(data, len, options);
+    }
+    return send_packet_now(data, len, options);
+}
+
+wiced_result_t iotconnect_sdk_send_ack(const char *data) {
+    IotconnectSendOptions options = {.priority = IOTC_PRIORITY_HIGH};
+    return iotconnect_sdk_send_packet_ex((const uint8_t *) data, strlen(data), &options);
+}
+
+uint32_t iotconnect_sdk_get_telemetry_interval() {
+    return config.telemetry_interval_max_ms ? iotc_interval_get() : 0;
+}
+
+wiced_result_t iotconnect_sdk_flush() {
+    if (iotc_publisher_is_enabled()) {
+        flush_requested = true;
+        iotc_publisher_wake();
+        return WICED_SUCCESS;
+    }
+    return iotc_coalesce_flush();
+}
+
+wiced_result_t iotconnect_sdk_send_packet(const char *data) {
+    return iotconnect_sdk_send_packet_ex((const uint8_t *) data, strlen(data), NULL);
+}
+
+wiced_result_t iotconnect_sdk_send_data_packet(uint8_t *data, size_t len) {
+    return iotconnect_sdk_send_packet_ex(data, len, NULL);
+}
+
+wiced_result_t iotconnect_sdk_send_data_packet_qos(uint8_t *data, size_t len, wiced_mqtt_qos_level_t qos) {
+    IotconnectSendOptions options = {0};
+    if (qos == WICED_MQTT_QOS_DELIVER_AT_MOST_ONCE) {
+        options.qos0 = true;
+    } else if (qos != WICED_MQTT_QOS_DELIVER_AT_LEAST_ONCE) {
+        WPRINT_LIB_INFO(("Error: Only QoS 0 and 1 are supported\n"));
+        return WICED_BADARG;
+    }
+    return iotconnect_sdk_send_packet_ex(data, len, &options);
+}
+
+wiced_result_t iotconnect_sdk_send_packet_qos(const char *data, wiced_mqtt_qos_level_t qos) {
+    return iotconnect_sdk_send_data_packet_qos((uint8_t *) data, strlen(data), qos);
+}
+
+// The queue is released by a disconnect while the client is paused
+void iotconnect_sdk_get_queue_stats(IotconnectQueueStats *stats) {
+    if (!stats) {
+        return;
+    }
+    if (!client_enter()) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    iotc_outbound_queue_get_stats(stats);
+    client_exit();
+}
+
+void iotconnect_sdk_get_priority_stats(IotconnectSendPriority priority, IotconnectPriorityStats *stats) {
+    if (!stats || priority >= IOTC_PRIORITY_NUM) {
+        return;
+    }
+    if (!client_enter()) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    iotc_outbound_queue_get_priority_stats(priority, stats);
+    client_exit();
+    stats->sent_direct = sent_direct[priority];
+}
+
+void iotconnect_sdk_get_reconnect_stats(IotconnectReconnectStats *stats) {
+    if (client_enter()) {
+        iotc_wiced_mqtt_get_reconnect_stats(mqtt_client, stats);
+        client_exit();
+    }
+}
+
+void iotconnect_sdk_get_publish_stats(IotconnectPublishStats *stats) {
+    if (client_enter()) {
+        iotc_wiced_mqtt_get_publish_stats(mqtt_client, stats);
+        client_exit();
+    }
+}
+
+void iotconnect_sdk_get_tls_stats(IotconnectTlsStats *stats) {
+    iotc_tls_session_get_stats(stats);
+}
+
+void iotconnect_sdk_get_keepalive_stats(IotconnectKeepaliveStats *stats) {
+    iotc_keepalive_get_stats(&keepalive, stats);
+}
+
+void iotconnect_sdk_get_coalesce_stats(IotconnectCoalesceStats *stats) {
+    iotc_coalesce_get_stats(stats);
+}
+
+void iotconnect_sdk_get_compression_stats(IotconnectCompressionStats *stats) {
+    iotc_compress_get_stats(stats);
+}
+
+void iotconnect_sdk_get_rate_limit_stats(IotconnectRateLimitStats *stats) {
+    iotc_rate_limit_get_stats(stats);
+}
+
+void iotconnect_sdk_get_publisher_stats(IotconnectPublisherStats *stats) {
+    if (stats) {
+        memset(stats, 0, sizeof(*stats));
+        iotc_publisher_get_stats(stats);
+    }
+}
+
+void iotconnect_sdk_get_inbound_stats(IotconnectInboundStats *stats) {
+    if (stats) {
+        *stats = inbound_stats;
+        iotc_inbound_queue_get_stats(stats);
+    }
+}
+
+static void process_inbound(const uint8_t *data, size_t len, const uint8_t *topic, const uint32_t topic_len) {
+    if (iotc_topic_dispatch(topic, topic_len, data, len)) {
+        return;
+    }
+    // a command that is redelivered after a reconnect must not be executed twice
+    if (iotc_dedup_is_duplicate(topic, topic_len, data, len)) {
+        WPRINT_LIB_INFO(("Dropped a duplicate inbound message\n"));
+        inbound_stats.duplicates++;
+        return;
+    }
+    inbound_stats.received++;
+    // the queue terminates the message in place, so it's parsed without a copy
+    if (!iotcl_process_event((const char *) data)) {
+        int shown = len < 64 ? (int) len : 64; // messages can be large
+        WPRINT_LIB_INFO(("Error encountered while processing %.*s\n", shown, (const char *) data));
+    }
+}
+
+static wiced_result_t process_inbound_queue(void *arg);
+
+static void schedule_inbound_processing() {
+    if (inbound_scheduled || config.poll_mode) {
+        return;
+    }
+    inbound_scheduled = true;
+    if (WICED_SUCCESS != wiced_rtos_send_asynchronous_event(sdk_worker, process_inbound_queue, NULL)) {
+        // the messages stay queued until the next one arrives
+        inbound_scheduled = false;
+        WPRINT_LIB_INFO(("Warning: Unable to schedule inbound message processing\n"));
+    }
+}
+
+static wiced_result_t process_inbound_queue(void *arg) {
+    (void) arg;
+    // cleared before draining, so that a message queued after the last check schedules another event
+    inbound_scheduled = false;
+    iotc_inbound_queue_drain(process_inbound, IOTC_SDK_INBOUND_BATCH);
+    if (!iotc_inbound_queue_is_empty()) {
+        schedule_inbound_processing();
+    }
+    return WICED_SUCCESS;
+}
+
+// Called on the MQTT thread. Only queues the message, so that slow callbacks don't hold back the network.
+static void iotc_on_mqtt_data(const uint8_t *data, size_t len, const uint8_t *topic, const uint32_t topic_len,
+                              void *ctx) {
+    (void) ctx;
+    if (WICED_SUCCESS != iotc_inbound_queue_push(data, len, topic, topic_len)) {
+        WPRINT_LIB_INFO(("Warning: Inbound queue is full. Dropped a message of %lu bytes\n", (unsigned long) len));
+        return;
+    }
+    schedule_inbound_processing();
+}
+
+static IotclSyncResponse *discover() {
+    iotc_wiced_discovery_init();
+    IotclSyncResponse *sr = iotc_wiced_discover(
+            config.env,
+            config.cpid,
+            config.duid,
+            config.num_discovery_tires
+    );
+    iotc_wiced_discovery_deinit();
+
+    if (!sr || sr->ds != IOTCL_SR_OK) {
+        report_sync_error(sr);
+        iotcl_discovery_free_sync_response(sr);
+        return NULL;
+    }
+    // iotc-c-lib allocates each string separately. The SDK keeps them in one block for as long as it runs.
+    IotclSyncResponse *packed = iotc_sr_arena_pack(sr);
+    iotcl_discovery_free_sync_response(sr);
+    return packed;
+}
+
+// Discovers and stores the result into the cache
+static IotclSyncResponse *run_discovery() {
+    IotclSyncResponse *sr = discover();
+    if (sr && config.sr_cache_storage) {
+        if (WICED_SUCCESS != iotc_sr_cache_store(config.sr_cache_storage, config.cpid, config.env, config.duid, sr,
+                                                 config.sr_cache_ttl_secs)) {
+            WPRINT_LIB_INFO(("Warning: Failed to store the sync response into the cache\n"));
+        }
+    }
+    return sr;
+}
+
+// Azure style topics take properties appended to the topic: "devices/<id>/messages/events/$.ce=lzf&..."
+static char *build_compressed_pub_topic(IotclSyncResponse *sr) {
+    free(compressed_pub_topic);
+    compressed_pub_topic = NULL;
+    if (!iotc_compress_is_enabled()) {
+        return NULL;
+    }
+    const char *topic = sr->broker.pub_topic;
+    size_t topic_len = strlen(topic);
+    // if the topic has properties already, the new one needs a separator
+    const char *separator = (topic_len > 0 && topic[topic_len - 1] != '/') ? "&" : "";
+    compressed_pub_topic = malloc(topic_len + strlen(separator) + strlen(IOTC_SDK_COMPRESSED_TOPIC_PROPERTY) + 1);
+    if (compressed_pub_topic) {
+        sprintf(compressed_pub_topic, "%s%s%s", topic, separator, IOTC_SDK_COMPRESSED_TOPIC_PROPERTY);
+    }
+    return compressed_pub_topic;
+}
+
+static wiced_result_t mqtt_connect(IotclSyncResponse *sr, bool retry) {
+    memset(&mqtt_config, 0, sizeof(mqtt_config));
+    mqtt_config.sr = sr;
+    mqtt_config.data_cb = iotc_on_mqtt_data;
+    mqtt_config.status_cb = on_iotconnect_status;
+    mqtt_config.poll_mode = config.poll_mode;
+    // the publisher thread is the only one that publishes, retransmissions included
+    mqtt_config.inflight_check_polled = iotc_publisher_is_enabled();
+    mqtt_config.retry_connect = retry;
+    mqtt_config.mqtt_timeout_ms = config.mqtt_timeout_ms; // if it is not assigned, the mqtt module will default it
+    mqtt_config.publish_window = config.publish_window;
+    mqtt_config.puback_timeout_ms = config.puback_timeout_ms;
+    mqtt_config.max_retransmits = config.max_retransmits;
+    mqtt_config.persistent_session = config.persistent_session;
+    mqtt_config.keepalive_secs = config.keepalive_secs;
+    mqtt_config.keepalive_probe_max_secs = config.keepalive_probe_max_secs;
+    mqtt_config.keepalive = &keepalive;
+    mqtt_config.compressed_pub_topic = build_compressed_pub_topic(sr);
+    mqtt_config.extra_sub_topics = extra_subscriptions;
+    mqtt_config.num_extra_sub_topics = iotc_topic_dispatch_build(sr->broker.sub_topic, extra_subscriptions,
+                                                                 IOTC_SDK_MAX_TOPIC_HANDLERS);
+    return iotc_wiced_mqtt_create(&mqtt_client, &mqtt_config, &config.security);
+}
+
+static void on_message_intercept(IotclEventData data, IotConnectEventType type);
+
+static void init_lib(IotclSyncResponse *sr) {
+    lib_config.device.env = config.env;
+    lib_config.device.cpid = config.cpid;
+    lib_config.device.duid = config.duid;
+    lib_config.telemetry.dtg = sr->dtg;
+    lib_config.event_functions.ota_cb = config.ota_cb;
+    lib_config.event_functions.cmd_cb = config.cmd_cb;
+
+    // intercept internal processing and forward to client
+    lib_config.event_functions.msg_cb = on_message_intercept;
+
+    if (!iotcl_init(&lib_config)) {
+        WPRINT_LIB_INFO(("Failed to initialize the IoTConnect Lib\n"));
+    }
+}
+
+// Frees the current sync response and points the lib config at sr, which can be NULL
+static void use_sync_response(IotclSyncResponse *sr) {
+    wiced_rtos_lock_mutex(&lib_config_mutex);
+    iotc_sr_arena_free(sync_response);
+    sync_response = sr;
+    if (sr) {
+        init_lib(sr);
+    }
+    wiced_rtos_unlock_mutex(&lib_config_mutex);
+}
+
+static bool str_equal(const char *a, const char *b) {
+    return a == b || (a && b && 0 == strcmp(a, b));
+}
+
+// True if a connection made with one sync response is also valid for the other
+static bool broker_equal(const IotclSyncResponse *a, const IotclSyncResponse *b) {
+    return str_equal(a->broker.host, b->broker.host)
+           && str_equal(a->broker.client_id, b->broker.client_id)
+           && str_equal(a->broker.user_name, b->broker.user_name)
+           && str_equal(a->broker.pass, b->broker.pass)
+           && str_equal(a->broker.sub_topic, b->broker.sub_topic)
+           && str_equal(a->broker.pub_topic, b->broker.pub_topic);
+}
+
+static void init_finish();
+
+/*
+ * Switch to a fresh sync response, which this function takes ownership of. The connection is only replaced if
+ * the broker parameters changed, so that the session and the messages in flight survive a dtg change.
+ * A new connection that fails is retried with the reconnect backoff, rather than leaving the device offline.
+ */
+static wiced_result_t apply_sync_response(IotclSyncResponse *fresh) {
+    // the pending batch was built with the current dtg, so it has to go out before the dtg changes
+    (void) iotc_coalesce_flush();
+    // a dtg that doesn't fit the room reserved for it is handled like a broker change
+    if (sync_response && broker_equal(sync_response, fresh)) {
+        // the dtg is updated in place, where both configs point already
+        wiced_rtos_lock_mutex(&lib_config_mutex);
+        bool updated = str_equal(sync_response->dtg, fresh->dtg) || iotc_sr_arena_set_dtg(sync_response, fresh->dtg);
+        wiced_rtos_unlock_mutex(&lib_config_mutex);
+        if (updated) {
+            iotc_sr_arena_free(fresh);
+            WPRINT_LIB_INFO(("Broker parameters are unchanged. Keeping the connection\n"));
+            return WICED_SUCCESS;
+        }
+    }
+
+    WPRINT_LIB_INFO(("Broker parameters have changed. Reconnecting...\n"));
+    is_initialized = false;
+    stop_link_evaluation();
+    // messages sent from now on are queued until the new client is up
+    client_pause();
+    iotc_wiced_mqtt_disconnect(mqtt_client);
+    iotc_wiced_mqtt_destroy(mqtt_client);
+    mqtt_client = NULL;
+    use_sync_response(fresh);
+    wiced_result_t ret = mqtt_connect(sync_response, true);
+    client_resume();
+    if (WICED_SUCCESS != ret) {
+        // only if the client couldn't be created at all, e.g. out of memory
+        WPRINT_LIB_INFO(("Error: Unable to connect with the new broker parameters\n"));
+        return ret;
+    }
+    init_finish();
+    return WICED_SUCCESS;
+}
+
 static void on_message_intercept(IotclEventData data, IotConnectEventType type) {
     switch (type) {
-        case ON_FORCE_SYNC:
-            iotconnect_sdk_disconnect();
-            sync_response = iotc_wiced_discover(config.env, config.cpid, config.duid, config.num_discovery_tires);
-            if (!sync_response || sync_response->ds != IOTCL_SR_OK) {
-                report_sync_error(sync_response);
-                iotcl_discovery_free_sync_response(sync_response);
-                sync_response = NULL;
-                return;
+        case ON_FORCE_SYNC: {
+            // runs on the SDK thread, so the connection keeps working during discovery
+            IotclSyncResponse *fresh = run_discovery();
+            if (!fresh) {
+                WPRINT_LIB_INFO(("Warning: Discovery failed. Keeping the current connection\n"));
+                break;
             }
-            (void) iotc_wiced_mqtt_init(&mqtt_config, &config.security);
+            (void) apply_sync_response(fresh);
             break;
+        }
         case ON_CLOSE:
             WPRINT_LIB_INFO(("Got a disconnect request. Closing the mqtt connection. Device restart is required.\n"));
             iotconnect_sdk_disconnect();
@@ -116,25 +806,266 @@ IotclConfig *iotconnect_sdk_get_lib_config() {
     return iotcl_get_config();
 }
 
+IotclMessageHandle iotconnect_sdk_telemetry_create() {
+    IotclMessageHandle msg = NULL;
+    if (!lib_config_mutex_initialized) {
+        return NULL;
+    }
+    wiced_rtos_lock_mutex(&lib_config_mutex);
+    if (sync_response) {
+        msg = iotcl_telemetry_create(iotcl_get_config());
+    }
+    wiced_rtos_unlock_mutex(&lib_config_mutex);
+    return msg;
+}
+
 IotconnectClientConfig *iotconnect_sdk_init_and_get_config() {
+    if (!lib_config_mutex_initialized) {
+        wiced_rtos_init_mutex(&lib_config_mutex);
+        lib_config_mutex_initialized = true;
+    }
     memset(&config, 0, sizeof(config));
+    iotc_topic_dispatch_clear();
     return &config;
 }
 
+wiced_result_t iotconnect_sdk_register_topic_handler(const char *topic_filter, IotconnectTopicHandler handler,
+                                                     void *ctx) {
+    wiced_result_t ret = iotc_topic_dispatch_add(topic_filter, handler, ctx);
+    if (WICED_SUCCESS != ret) {
+        WPRINT_LIB_INFO(("Error: Unable to register a handler for topic %s\n", topic_filter ? topic_filter : ""));
+    }
+    return ret;
+}
+
 bool iotconnect_sdk_is_connected() {
-    return iotc_wiced_mqtt_is_connected();
+    if (!client_enter()) {
+        return false;
+    }
+    bool ret = iotc_wiced_mqtt_is_connected(mqtt_client);
+    client_exit();
+    return ret;
+}
+
+// The SDK keeps its reference for good, so MQTT clients destroyed on the worker never delete it
+static wiced_result_t create_sdk_worker() {
+    if (sdk_worker || config.poll_mode) {
+        return WICED_SUCCESS;
+    }
+    sdk_worker = iotc_worker_acquire();
+    return sdk_worker ? WICED_SUCCESS : WICED_ERROR;
+}
+
+static wiced_result_t init_prepare(void *arg) {
+    (void) arg;
+    if (0 == config.num_discovery_tires) {
+        config.num_discovery_tires = IOTC_SDK_DEFAULT_NUM_DISCOVERY_TRIES;
+    }
+    if (0 == config.sr_cache_ttl_secs) {
+        config.sr_cache_ttl_secs = IOTC_SDK_DEFAULT_SR_CACHE_TTL_SECS;
+    }
+
+    if (sync_response) {
+        use_sync_response(NULL);
+    }
+
+    memset(sent_direct, 0, sizeof(sent_direct));
+    memset(&inbound_stats, 0, sizeof(inbound_stats));
+    iotc_dedup_reset();
+
+    if (0 == config.inbound_queue_size) {
+        config.inbound_queue_size = IOTC_SDK_DEFAULT_INBOUND_QUEUE_SIZE;
+    }
+    if (0 == config.inbound_block_timeout_ms) {
+        config.inbound_block_timeout_ms = IOTC_SDK_DEFAULT_INBOUND_BLOCK_TIMEOUT_MS;
+    }
+    // without it, callbacks would run on the MQTT thread and hold back PUBACKs and keepalives
+    wiced_result_t ret = iotc_inbound_queue_init(config.inbound_queue_size, config.inbound_overflow_policy,
+                                                 config.inbound_block_timeout_ms);
+    if (WICED_SUCCESS != ret) {
+        WPRINT_LIB_INFO(("Error: Failed to initialize the inbound queue\n"));
+        return ret;
+    }
+
+    if (config.queue_size) {
+        if (0 == config.queue_priority_size) {
+            config.queue_priority_size = IOTC_SDK_DEFAULT_PRIORITY_QUEUE_SIZE;
+        }
+        IotcOutboundQueueConfig queue_config = {
+                .size = config.queue_size,
+                .drop_policy = config.queue_drop_policy,
+                .spill_storage = config.queue_spill_storage,
+                .priority_size = config.queue_priority_size
+        };
+        // telemetry is accepted from here on, even if the connection can't be established
+        if (WICED_SUCCESS != iotc_outbound_queue_init(&queue_config)) {
+            WPRINT_LIB_INFO(("Warning: Failed to initialize the outbound queue\n"));
+        }
+    }
+
+    if (config.compress_min_size) {
+        if (WICED_SUCCESS != iotc_compress_init(config.compress_min_size)) {
+            WPRINT_LIB_INFO(("Warning: Failed to initialize compression\n"));
+        }
+    }
+
+    if (config.telemetry_interval_max_ms) {
+        if (0 == config.telemetry_interval_min_ms) {
+            config.telemetry_interval_min_ms = IOTC_SDK_DEFAULT_TELEMETRY_INTERVAL_MIN_MS;
+        }
+        iotc_interval_init(config.telemetry_interval_min_ms, config.telemetry_interval_max_ms);
+    }
+
+    if (config.rate_limit_per_min) {
+        if (0 == config.rate_limit_burst) {
+            config.rate_limit_burst = config.rate_limit_per_min / 6 ? config.rate_limit_per_min / 6 : 1;
+        }
+        if (0 == config.rate_limit_block_timeout_ms) {
+            config.rate_limit_block_timeout_ms = IOTC_SDK_DEFAULT_RATE_LIMIT_BLOCK_TIMEOUT_MS;
+        }
+        if (WICED_SUCCESS != iotc_rate_limit_init(config.rate_limit_per_min, config.rate_limit_burst,
+                                                  config.rate_limit_policy, config.rate_limit_block_timeout_ms)) {
+            WPRINT_LIB_INFO(("Warning: Failed to initialize the rate limit\n"));
+        }
+    }
+
+    if (config.publisher_queue_len) {
+        if (0 == config.publisher_slot_size) {
+            config.publisher_slot_size = IOTC_SDK_DEFAULT_PUBLISHER_SLOT_SIZE;
+        }
+        if (WICED_SUCCESS != iotc_publisher_init(config.publisher_queue_len, config.publisher_slot_size,
+                                                 !config.poll_mode, publish_record, run_publish_work)) {
+            WPRINT_LIB_INFO(("Warning: Failed to initialize the publisher. Messages are sent by the caller\n"));
+        }
+    }
+
+    // the batch is flushed by the thread that publishes, rather than by a timer
+    wiced_worker_thread_t *flush_worker = iotc_publisher_is_enabled() ? NULL : sdk_worker;
+    if (config.coalesce_size) {
+        if (0 == config.coalesce_delay_ms) {
+            config.coalesce_delay_ms = IOTC_SDK_DEFAULT_COALESCE_DELAY_MS;
+        }
+        if (WICED_SUCCESS != iotc_coalesce_init(config.coalesce_size, config.coalesce_delay_ms, flush_worker,
+                                                send_batch)) {
+            WPRINT_LIB_INFO(("Warning: Failed to initialize publish coalescing\n"));
+        }
+    } else if (config.rate_limit_per_min && config.rate_limit_policy == IOTC_RATE_LIMIT_AGGREGATE) {
+        // aggregated records are flushed about when the next message is allowed
+        uint32_t delay_ms = 60000 / config.rate_limit_per_min;
+        if (delay_ms < IOTC_SDK_DEFAULT_COALESCE_DELAY_MS) {
+            delay_ms = IOTC_SDK_DEFAULT_COALESCE_DELAY_MS;
+        }
+        if (WICED_SUCCESS != iotc_coalesce_init(IOTC_SDK_RATE_LIMIT_AGGREGATE_SIZE, delay_ms, flush_worker,
+                                                send_batch)) {
+            WPRINT_LIB_INFO(("Warning: Failed to initialize rate limit aggregation\n"));
+        }
+    }
+
+    iotc_tls_session_init(config.tls_session_storage);
+    return WICED_SUCCESS;
+}
+
+static wiced_result_t init_resolve() {
+    IotclSyncResponse *sr = NULL;
+    init_from_cache = false;
+    if (config.sr_cache_storage) {
+        sr = iotc_sr_cache_load(config.sr_cache_storage, config.cpid, config.env, config.duid, config.sr_revalidate);
+        init_from_cache = (NULL != sr);
+    }
+    if (!sr) {
+        sr = run_discovery();
+        if (!sr) {
+            return WICED_ERROR;
+        }
+    }
+
+    WPRINT_LIB_INFO(("CPID: %.*s***\n", 4, sr->cpid));
+    WPRINT_LIB_INFO(("ENV:  %s\n", config.env));
+
+    use_sync_response(sr);
+    return WICED_SUCCESS;
+}
+
+static wiced_result_t connect_current(void *ctx) {
+    (void) ctx;
+    return mqtt_connect(sync_response, false);
+}
+
+// The cached sync response was rejected. iotc_sr_cache_connect stores the fresh one.
+static const IotclSyncResponse *rediscover(void *ctx) {
+    (void) ctx;
+    init_from_cache = false;
+    use_sync_response(discover());
+    return sync_response;
+}
+
+static wiced_result_t init_connect() {
+    if (!init_from_cache) {
+        return mqtt_connect(sync_response, false);
+    }
+    return iotc_sr_cache_connect(config.sr_cache_storage, config.cpid, config.env, config.duid,
+                                 config.sr_cache_ttl_secs, connect_current, rediscover, NULL);
+}
+
+// Checks the cached sync response that the connection was made with against a fresh discovery
+static wiced_result_t revalidate(void *arg) {
+    (void) arg;
+    revalidate_pending = false;
+    if (!is_initialized || !sync_response) {
+        return WICED_SUCCESS; // disconnected in the meantime
+    }
+    IotclSyncResponse *fresh = run_discovery(); // also refreshes the cache
+    if (!fresh) {
+        WPRINT_LIB_INFO(("Warning: Discovery failed. Keeping the cached sync response\n"));
+        return WICED_SUCCESS;
+    }
+    if (!is_initialized) {
+        iotc_sr_arena_free(fresh);
+        return WICED_SUCCESS;
+    }
+    return apply_sync_response(fresh);
+}
+
+static void schedule_revalidate() {
+    revalidate_pending = true;
+    if (config.poll_mode) {
+        return; // picked up by iotconnect_sdk_loop
+    }
+    if (WICED_SUCCESS != wiced_rtos_send_asynchronous_event(sdk_worker, revalidate, NULL)) {
+        revalidate_pending = false;
+        WPRINT_LIB_INFO(("Warning: Unable to schedule the sync response revalidation\n"));
+    }
 }
 
-void iotc_on_mqtt_data(const uint8_t *data, size_t len, const uint8_t *topic, const uint32_t topic_len) {
-    (void) topic; // ignore topic for now
-    (void) topic_len;
-    char *str = malloc(len + 1);
-    memcpy(str, data, len);
-    str[len] = 0;
-    if (!iotcl_process_event(str)) {
-        WPRINT_LIB_INFO(("Error encountered while processing %s\n", str));
+static void init_finish() {
+    is_initialized = true;
+    schedule_queue_drain();
+    start_link_evaluation();
+    if (init_from_cache && config.sr_revalidate) {
+        // only once per init. A reconnect with a fresh sync response must not trigger another round.
+        init_from_cache = false;
+        schedule_revalidate();
     }
-    free(str);
+}
+
+static wiced_result_t init_all(void *arg) {
+    (void) arg;
+    wiced_result_t ret = init_prepare(NULL);
+    if (WICED_SUCCESS != ret) {
+        return ret;
+    }
+
+    ret = init_resolve();
+    if (WICED_SUCCESS != ret) {
+        return ret;
+    }
+    ret = init_connect();
+    if (WICED_SUCCESS != ret) {
+        return ret;
+    }
+
+    init_finish();
+    return WICED_SUCCESS;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////
@@ -142,54 +1073,161 @@ void iotc_on_mqtt_data(const uint8_t *data, size_t len, const uint8_t *topic, co
 wiced_result_t iotconnect_sdk_init() {
     wiced_result_t ret;
 
-    if (0 == config.num_discovery_tires) {
-        config.num_discovery_tires = IOTC_SDK_DEFAULT_NUM_DISCOVERY_TRIES;
+    if (init_state != INIT_IDLE) {
+        WPRINT_LIB_INFO(("Error: Init is already in progress\n"));
+        return WICED_ERROR;
+    }
+    ret = create_sdk_worker();
+    if (WICED_SUCCESS != ret) {
+        return ret;
     }
+    // still blocks the caller, but discovery and the handshake run on the worker's stack
+    return run_on_sdk_worker(init_all);
+}
 
-    iotc_wiced_discovery_init();
-    IotclSyncResponse *local_sync_response = iotc_wiced_discover(
-            config.env,
-            config.cpid,
-            config.duid,
-            config.num_discovery_tires
-    );
-    iotc_wiced_discovery_deinit();
+static void report_init_status(IotconnectConnectionStatus status, wiced_result_t *result) {
+    if (config.status_cb) {
+        config.status_cb(status, result);
+    }
+}
 
-    if (!local_sync_response || local_sync_response->ds != IOTCL_SR_OK) {
-        report_sync_error(local_sync_response);
-        iotcl_discovery_free_sync_response(local_sync_response);
-        local_sync_response = NULL;
-        return WICED_ERROR;
+// Runs one init step per event, so that iotconnect_sdk_disconnect can stop it in between
+static wiced_result_t init_step(void *arg) {
+    (void) arg;
+    wiced_result_t ret = WICED_SUCCESS;
+    InitState next;
+
+    switch (init_state) {
+        case INIT_RESOLVE:
+            report_init_status(IOTC_INIT_DISCOVERY, NULL);
+            ret = init_resolve();
+            next = INIT_CONNECT;
+            break;
+        case INIT_CONNECT:
+            report_init_status(IOTC_INIT_CONNECTING, NULL);
+            ret = init_connect();
+            next = INIT_FINISH;
+            break;
+        case INIT_FINISH:
+            init_state = INIT_IDLE;
+            init_finish();
+            report_init_status(IOTC_INIT_DONE, NULL);
+            return WICED_SUCCESS;
+        default:
+            return WICED_SUCCESS; // cancelled
     }
 
-    WPRINT_LIB_INFO(("CPID: %.*s***\n", 4, local_sync_response->cpid));
-    WPRINT_LIB_INFO(("ENV:  %s\n", config.env));
+    if (init_state == INIT_IDLE) {
+        // disconnect was requested while the step was running
+        if (next == INIT_FINISH && WICED_SUCCESS == ret) {
+            iotconnect_sdk_disconnect();
+        }
+        return WICED_SUCCESS;
+    }
+    if (WICED_SUCCESS != ret) {
+        WPRINT_LIB_INFO(("Error: Async init failed\n"));
+        init_state = INIT_IDLE;
+        report_init_status(IOTC_INIT_FAILED, &ret);
+        return ret;
+    }
 
-    memset(&mqtt_config, 0, sizeof(mqtt_config));
-    mqtt_config.sr = local_sync_response; // FIXME local_sync_response is a local pointer that will go out of scope
-    mqtt_config.data_cb = iotc_on_mqtt_data;
-    mqtt_config.status_cb = on_iotconnect_status;
-    mqtt_config.mqtt_timeout_ms = config.mqtt_timeout_ms; // if it is not assigned, the mqtt module will default it
+    init_state = next;
+    if (config.poll_mode) {
+        return WICED_SUCCESS; // the next iotconnect_sdk_loop runs the next step
+    }
+    ret = wiced_rtos_send_asynchronous_event(sdk_worker, init_step, NULL);
+    if (WICED_SUCCESS != ret) {
+        init_state = INIT_IDLE;
+        report_init_status(IOTC_INIT_FAILED, &ret);
+    }
+    return ret;
+}
+
+wiced_result_t iotconnect_sdk_init_async() {
+    wiced_result_t ret;
 
-    ret = iotc_wiced_mqtt_init(&mqtt_config, &config.security);
+    if (init_state != INIT_IDLE) {
+        WPRINT_LIB_INFO(("Error: Init is already in progress\n"));
+        return WICED_ERROR;
+    }
+    ret = create_sdk_worker();
     if (WICED_SUCCESS != ret) {
         return ret;
     }
 
-    lib_config.device.env = config.env;
-    lib_config.device.cpid = config.cpid;
-    lib_config.device.duid = config.duid;
-    lib_config.telemetry.dtg = local_sync_response->dtg; // FIXME local_sync_response is a local pointer that will go out of scope
-                                                         // unclear what happens to its pointers?
-    lib_config.event_functions.ota_cb = config.ota_cb;
-    lib_config.event_functions.cmd_cb = config.cmd_cb;
+    ret = run_on_sdk_worker(init_prepare);
+    if (WICED_SUCCESS != ret) {
+        return ret;
+    }
 
-    // intercept internal processing and forward to client
-    lib_config.event_functions.msg_cb = on_message_intercept;
+    init_state = INIT_RESOLVE;
+    if (config.poll_mode) {
+        return WICED_SUCCESS;
+    }
+    ret = wiced_rtos_send_asynchronous_event(sdk_worker, init_step, NULL);
+    if (WICED_SUCCESS != ret) {
+        init_state = INIT_IDLE;
+    }
+    return ret;
+}
 
-    if (!iotcl_init(&lib_config)) {
-        WPRINT_LIB_INFO(("Failed to initialize the IoTConnect Lib\n"));
+static uint32_t time_until(wiced_time_t now, wiced_time_t t) {
+    return (int32_t) (t - now) > 0 ? t - now : 0;
+}
+
+uint32_t iotconnect_sdk_loop(uint32_t budget_ms) {
+    wiced_time_t start;
+    wiced_time_t now;
+    uint32_t next = UINT32_MAX;
+
+    if (!config.poll_mode) {
+        return UINT32_MAX; // the SDK threads do the work
+    }
+    if (init_state != INIT_IDLE) {
+        // init steps block until they complete, so one per call
+        (void) init_step(NULL);
+        return 0;
     }
 
-    return 0;
+    if (revalidate_pending) {
+        // like init steps, discovery can't be split
+        (void) revalidate(NULL);
+        return 0;
+    }
+
+    wiced_time_get_time(&start);
+    while (iotc_inbound_queue_drain(process_inbound, 1) > 0) {
+        wiced_time_get_time(&now);
+        if (now - start >= budget_ms) {
+            return 0;
+        }
+    }
+
+    while (iotc_publisher_process(1) > 0) {
+        wiced_time_get_time(&now);
+        if (now - start >= budget_ms) {
+            return 0;
+        }
+    }
+
+    uint32_t due = run_publish_work();
+    next = due < next ? due : next;
+
+    wiced_time_get_time(&now);
+    if (link_evaluation_active) {
+        if (0 == time_until(now, link_evaluation_at)) {
+            link_evaluation_at = now + IOTC_SDK_INTERVAL_EVAL_MS;
+            (void) evaluate_link(NULL);
+        }
+        due = time_until(now, link_evaluation_at);
+        next = due < next ? due : next;
+    }
+
+    due = iotc_wiced_mqtt_poll(mqtt_client);
+    next = due < next ? due : next;
+
+    if (!iotc_inbound_queue_is_empty() || !iotc_publisher_is_empty() || drain_pending) {
+        next = 0;
+    }
+    return next;
 }
@@ -0,0 +1,147 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "iotconnect_discovery.h"
+#include "iotc_wiced_discovery.h"
+#include "iotc_wiced_mqtt.h"
+#include "iotc_sr_arena.h"
+#include "iotc_sdk.h"
+
+#define IOTC_SESSION_DEFAULT_NUM_DISCOVERY_TRIES 3
+
+struct IotconnectSession {
+    IotconnectSessionConfig config;
+    IotclSyncResponse *sr;
+    bool owns_sr; // sr came from discovery and is freed with the session
+    IotconnectMqttConfig mqtt_config;
+    IotcKeepalive keepalive;
+    IotcMqttClient *client;
+};
+
+static void on_session_data(const uint8_t *data, size_t len, const uint8_t *topic, const uint32_t topic_len,
+                            void *ctx) {
+    IotconnectSession *session = (IotconnectSession *) ctx;
+    session->config.data_cb(session, topic, topic_len, data, len, session->config.ctx);
+}
+
+static void on_session_status(IotconnectConnectionStatus status, void *event_data, void *ctx) {
+    IotconnectSession *session = (IotconnectSession *) ctx;
+    if (session->config.status_cb) {
+        session->config.status_cb(session, status, event_data, session->config.ctx);
+    }
+}
+
+static IotclSyncResponse *session_discover(IotconnectSessionConfig *config) {
+    iotc_wiced_discovery_init();
+    IotclSyncResponse *sr = iotc_wiced_discover(config->env, config->cpid, config->duid,
+                                                config->num_discovery_tires);
+    iotc_wiced_discovery_deinit();
+
+    if (!sr || sr->ds != IOTCL_SR_OK) {
+        WPRINT_LIB_INFO(("Error: Discovery failed for device %s\n", config->duid ? config->duid : ""));
+        iotcl_discovery_free_sync_response(sr);
+        return NULL;
+    }
+    IotclSyncResponse *packed = iotc_sr_arena_pack(sr);
+    iotcl_discovery_free_sync_response(sr);
+    return packed;
+}
+
+static void session_free(IotconnectSession *session) {
+    if (session->owns_sr) {
+        iotc_sr_arena_free(session->sr);
+    }
+    free(session);
+}
+
+IotconnectSession *iotconnect_session_create(const IotconnectSessionConfig *config) {
+    if (!config || !config->data_cb) {
+        WPRINT_LIB_INFO(("Error: A session requires a config with data_cb\n"));
+        return NULL;
+    }
+    IotconnectSession *session = calloc(1, sizeof(IotconnectSession));
+    if (!session) {
+        return NULL;
+    }
+    session->config = *config;
+    if (0 == session->config.num_discovery_tires) {
+        session->config.num_discovery_tires = IOTC_SESSION_DEFAULT_NUM_DISCOVERY_TRIES;
+    }
+
+    if (config->sr) {
+        session->sr = config->sr;
+    } else {
+        session->sr = session_discover(&session->config);
+        if (!session->sr) {
+            session_free(session);
+            return NULL;
+        }
+        session->owns_sr = true;
+    }
+
+    IotconnectMqttConfig *mqtt_config = &session->mqtt_config;
+    mqtt_config->sr = session->sr;
+    mqtt_config->mqtt_timeout_ms = session->config.mqtt_timeout_ms;
+    mqtt_config->publish_window = session->config.publish_window;
+    mqtt_config->persistent_session = session->config.persistent_session;
+    mqtt_config->keepalive_secs = session->config.keepalive_secs;
+    mqtt_config->keepalive = &session->keepalive;
+    mqtt_config->poll_mode = session->config.poll_mode;
+    mqtt_config->data_cb = on_session_data;
+    mqtt_config->status_cb = on_session_status;
+    mqtt_config->cb_ctx = session;
+    if (WICED_SUCCESS != iotc_wiced_mqtt_create(&session->client, mqtt_config, &session->config.security)) {
+        WPRINT_LIB_INFO(("Error: Unable to connect device %s\n", session->sr->broker.client_id));
+        session_free(session);
+        return NULL;
+    }
+    return session;
+}
+
+wiced_result_t iotconnect_session_send(IotconnectSession *session, const uint8_t *data, size_t len,
+                                       const IotconnectSendOptions *options) {
+    if (!session) {
+        return WICED_BADARG;
+    }
+    IotconnectPublishCallback cb = options ? options->publish_cb : NULL;
+    void *ctx = options ? options->publish_ctx : NULL;
+    wiced_mqtt_qos_level_t qos = (options && options->qos0) ?
+                                 WICED_MQTT_QOS_DELIVER_AT_MOST_ONCE : WICED_MQTT_QOS_DELIVER_AT_LEAST_ONCE;
+    if (0 == iotc_wiced_mqtt_publish(session->client, data, len, qos, 0, cb, ctx)) {
+        return WICED_ERROR;
+    }
+    return WICED_SUCCESS;
+}
+
+bool iotconnect_session_is_connected(IotconnectSession *session) {
+    return session && iotc_wiced_mqtt_is_connected(session->client);
+}
+
+void iotconnect_session_get_publish_stats(IotconnectSession *session, IotconnectPublishStats *stats) {
+    if (session) {
+        iotc_wiced_mqtt_get_publish_stats(session->client, stats);
+    }
+}
+
+void iotconnect_session_get_reconnect_stats(IotconnectSession *session, IotconnectReconnectStats *stats) {
+    if (session) {
+        iotc_wiced_mqtt_get_reconnect_stats(session->client, stats);
+    }
+}
+
+uint32_t iotconnect_session_poll(IotconnectSession *session) {
+    return session ? iotc_wiced_mqtt_poll(session->client) : UINT32_MAX;
+}
+
+void iotconnect_session_destroy(IotconnectSession *session) {
+    if (!session) {
+        return;
+    }
+    iotc_wiced_mqtt_disconnect(session->client);
+    iotc_wiced_mqtt_destroy(session->client);
+    session_free(session);
+}
@@ -0,0 +1,85 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "iotc_sr_arena.h"
+
+typedef struct {
+    IotclSyncResponse sr; // must stay first, so that the sync response pointer is the arena pointer
+    size_t dtg_capacity; // excluding the NUL
+    char strings[];
+} IotcSrArena;
+
+static size_t string_size(const char *s) {
+    return s ? strlen(s) + 1 : 0;
+}
+
+// Copies s to *pos and advances it. NULL stays NULL.
+static char *put_string(char **pos, const char *s, size_t size) {
+    if (!s) {
+        return NULL;
+    }
+    char *ret = *pos;
+    memcpy(ret, s, size);
+    *pos += size;
+    return ret;
+}
+
+IotclSyncResponse *iotc_sr_arena_pack(const IotclSyncResponse *sr) {
+    if (!sr) {
+        return NULL;
+    }
+    size_t dtg_capacity = sr->dtg ? strlen(sr->dtg) : 0;
+    if (dtg_capacity < IOTC_SDK_SR_DTG_CAPACITY) {
+        dtg_capacity = IOTC_SDK_SR_DTG_CAPACITY;
+    }
+    size_t strings_size = string_size(sr->cpid)
+                          + dtg_capacity + 1
+                          + string_size(sr->broker.host)
+                          + string_size(sr->broker.client_id)
+                          + string_size(sr->broker.user_name)
+                          + string_size(sr->broker.pass)
+                          + string_size(sr->broker.sub_topic)
+                          + string_size(sr->broker.pub_topic);
+
+    IotcSrArena *arena = malloc(sizeof(IotcSrArena) + strings_size);
+    if (!arena) {
+        WPRINT_LIB_INFO(("Unable to allocate %lu bytes for the sync response\n",
+                (unsigned long) (sizeof(IotcSrArena) + strings_size)));
+        return NULL;
+    }
+    arena->sr = *sr;
+    arena->dtg_capacity = dtg_capacity;
+    char *pos = arena->strings;
+    arena->sr.cpid = put_string(&pos, sr->cpid, string_size(sr->cpid));
+    // the dtg always gets its room, even if it is missing now
+    arena->sr.dtg = pos;
+    arena->sr.dtg[0] = 0;
+    if (sr->dtg) {
+        strcpy(arena->sr.dtg, sr->dtg);
+    }
+    pos += dtg_capacity + 1;
+    arena->sr.broker.host = put_string(&pos, sr->broker.host, string_size(sr->broker.host));
+    arena->sr.broker.client_id = put_string(&pos, sr->broker.client_id, string_size(sr->broker.client_id));
+    arena->sr.broker.user_name = put_string(&pos, sr->broker.user_name, string_size(sr->broker.user_name));
+    arena->sr.broker.pass = put_string(&pos, sr->broker.pass, string_size(sr->broker.pass));
+    arena->sr.broker.sub_topic = put_string(&pos, sr->broker.sub_topic, string_size(sr->broker.sub_topic));
+    arena->sr.broker.pub_topic = put_string(&pos, sr->broker.pub_topic, string_size(sr->broker.pub_topic));
+    return &arena->sr;
+}
+
+bool iotc_sr_arena_set_dtg(IotclSyncResponse *sr, const char *dtg) {
+    IotcSrArena *arena = (IotcSrArena *) sr;
+    if (!arena || !dtg || strlen(dtg) > arena->dtg_capacity) {
+        return false;
+    }
+    strcpy(arena->sr.dtg, dtg);
+    return true;
+}
+
+void iotc_sr_arena_free(IotclSyncResponse *sr) {
+    free(sr); // the strings are part of the same block
+}
@@ -0,0 +1,34 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#pragma once
+
+#include <wiced.h>
+#include "iotconnect_discovery.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Room reserved for the dtg, so that a changed dtg (a GUID) can be stored in place
+#ifndef IOTC_SDK_SR_DTG_CAPACITY
+#define IOTC_SDK_SR_DTG_CAPACITY 36
+#endif
+
+// A copy of a sync response with the struct and all of its strings in a single allocation, so that a long running
+// device doesn't keep a dozen small blocks scattered over the heap for its lifetime.
+// Only the SDK owns such copies. They must be freed with iotc_sr_arena_free, not iotcl_discovery_free_sync_response.
+
+// Returns NULL if sr is NULL or the arena can't be allocated. sr is not modified.
+IotclSyncResponse *iotc_sr_arena_pack(const IotclSyncResponse *sr);
+
+// Stores dtg in place. Returns false if it is longer than the room reserved for it.
+bool iotc_sr_arena_set_dtg(IotclSyncResponse *sr, const char *dtg);
+
+void iotc_sr_arena_free(IotclSyncResponse *sr);
+
+#ifdef __cplusplus
+}
+#endif
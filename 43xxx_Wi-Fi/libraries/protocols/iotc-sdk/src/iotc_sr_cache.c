@@ -0,0 +1,248 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "iotc_sr_cache.h"
+#include "iotc_sr_arena.h"
+
+#define SR_CACHE_MAGIC 0x43525349 // "ISRC"
+#define SR_CACHE_VERSION 1
+#define SR_CACHE_NULL_FIELD 0xFFFF
+
+#ifndef IOTC_SR_CACHE_MAX_DATA_SIZE
+#define IOTC_SR_CACHE_MAX_DATA_SIZE 1024
+#endif
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t data_len;
+    uint32_t expires_at; // time() seconds
+    uint32_t checksum; // FNV-1a of the data that follows the header
+} IotcSrCacheHeader;
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t pos;
+} SrCacheCursor;
+
+static uint32_t fnv1a(const uint8_t *data, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool put_field(SrCacheCursor *c, const char *value) {
+    size_t value_len = value ? strlen(value) : 0;
+    if (value_len >= SR_CACHE_NULL_FIELD || c->pos + 2 + value_len > c->len) {
+        return false;
+    }
+    uint16_t prefix = value ? (uint16_t) value_len : SR_CACHE_NULL_FIELD;
+    memcpy(&c->data[c->pos], &prefix, 2);
+    c->pos += 2;
+    if (value_len) {
+        memcpy(&c->data[c->pos], value, value_len);
+        c->pos += value_len;
+    }
+    return true;
+}
+
+// Returns pointer to the field data (not NUL terminated) and its length, or NULL on a null field or an error.
+static const uint8_t *get_field(SrCacheCursor *c, uint16_t *value_len, bool *error) {
+    uint16_t prefix;
+    if (c->pos + 2 > c->len) {
+        *error = true;
+        return NULL;
+    }
+    memcpy(&prefix, &c->data[c->pos], 2);
+    c->pos += 2;
+    if (prefix == SR_CACHE_NULL_FIELD) {
+        *value_len = 0;
+        return NULL;
+    }
+    if (c->pos + prefix > c->len) {
+        *error = true;
+        return NULL;
+    }
+    const uint8_t *ret = &c->data[c->pos];
+    c->pos += prefix;
+    *value_len = prefix;
+    return ret;
+}
+
+static bool match_field(SrCacheCursor *c, const char *expected) {
+    bool error = false;
+    uint16_t value_len;
+    const uint8_t *value = get_field(c, &value_len, &error);
+    if (error || !value || !expected) {
+        return false;
+    }
+    return strlen(expected) == value_len && 0 == memcmp(value, expected, value_len);
+}
+
+static char *clone_field(SrCacheCursor *c, bool *error) {
+    uint16_t value_len;
+    const uint8_t *value = get_field(c, &value_len, error);
+    if (*error || !value) {
+        return NULL;
+    }
+    char *ret = malloc(value_len + 1);
+    if (!ret) {
+        *error = true;
+        return NULL;
+    }
+    memcpy(ret, value, value_len);
+    ret[value_len] = 0;
+    return ret;
+}
+
+// Frees the strings of a sync response assembled by clone_field
+static void free_fields(IotclSyncResponse *sr) {
+    free(sr->cpid);
+    free(sr->dtg);
+    free(sr->broker.host);
+    free(sr->broker.client_id);
+    free(sr->broker.user_name);
+    free(sr->broker.pass);
+    free(sr->broker.sub_topic);
+    free(sr->broker.pub_topic);
+}
+
+IotclSyncResponse *iotc_sr_cache_load(IotconnectNvStorage *storage, const char *cpid, const char *env,
+                                      const char *duid, bool accept_expired) {
+    IotcSrCacheHeader header;
+    if (!storage || !storage->read || storage->size < sizeof(header)) {
+        return NULL;
+    }
+    if (WICED_SUCCESS != storage->read(storage->ctx, 0, &header, sizeof(header))) {
+        return NULL;
+    }
+    if (header.magic != SR_CACHE_MAGIC || header.version != SR_CACHE_VERSION
+        || header.data_len > IOTC_SR_CACHE_MAX_DATA_SIZE
+        || header.data_len > storage->size - sizeof(header)) {
+        return NULL;
+    }
+    if ((uint32_t) time(NULL) >= header.expires_at && !accept_expired) {
+        WPRINT_LIB_INFO(("Cached sync response has expired\n"));
+        return NULL;
+    }
+
+    SrCacheCursor c = {.data = malloc(header.data_len), .len = header.data_len, .pos = 0};
+    if (!c.data) {
+        return NULL;
+    }
+    IotclSyncResponse *packed = NULL;
+    if (WICED_SUCCESS != storage->read(storage->ctx, sizeof(header), c.data, header.data_len)
+        || fnv1a(c.data, c.len) != header.checksum) {
+        WPRINT_LIB_INFO(("Cached sync response is corrupted\n"));
+        goto cleanup;
+    }
+    if (!match_field(&c, cpid) || !match_field(&c, env) || !match_field(&c, duid)) {
+        // cached for a different device
+        goto cleanup;
+    }
+
+    // the strings are cloned only to be packed, so they are freed here rather than by iotc-c-lib
+    IotclSyncResponse sr;
+    memset(&sr, 0, sizeof(sr));
+    bool error = false;
+    sr.ds = IOTCL_SR_OK;
+    sr.cpid = clone_field(&c, &error);
+    sr.dtg = clone_field(&c, &error);
+    sr.broker.host = clone_field(&c, &error);
+    sr.broker.client_id = clone_field(&c, &error);
+    sr.broker.user_name = clone_field(&c, &error);
+    sr.broker.pass = clone_field(&c, &error);
+    sr.broker.sub_topic = clone_field(&c, &error);
+    sr.broker.pub_topic = clone_field(&c, &error);
+    if (!error && sr.broker.host && sr.broker.client_id && sr.broker.sub_topic && sr.broker.pub_topic) {
+        packed = iotc_sr_arena_pack(&sr);
+    }
+    free_fields(&sr);
+
+    cleanup:
+    free(c.data);
+    return packed;
+}
+
+wiced_result_t iotc_sr_cache_store(IotconnectNvStorage *storage, const char *cpid, const char *env,
+                                   const char *duid, const IotclSyncResponse *sr, uint32_t ttl_secs) {
+    IotcSrCacheHeader header;
+    if (!storage || !storage->write || !sr || storage->size < sizeof(header)) {
+        return WICED_BADARG;
+    }
+    size_t max_len = storage->size - sizeof(header);
+    if (max_len > IOTC_SR_CACHE_MAX_DATA_SIZE) {
+        max_len = IOTC_SR_CACHE_MAX_DATA_SIZE;
+    }
+
+    SrCacheCursor c = {.data = malloc(max_len), .len = max_len, .pos = 0};
+    if (!c.data) {
+        return WICED_OUT_OF_HEAP_SPACE;
+    }
+    bool ok = put_field(&c, cpid) && put_field(&c, env) && put_field(&c, duid)
+              && put_field(&c, sr->cpid)
+              && put_field(&c, sr->dtg)
+              && put_field(&c, sr->broker.host)
+              && put_field(&c, sr->broker.client_id)
+              && put_field(&c, sr->broker.user_name)
+              && put_field(&c, sr->broker.pass)
+              && put_field(&c, sr->broker.sub_topic)
+              && put_field(&c, sr->broker.pub_topic);
+    if (!ok) {
+        WPRINT_LIB_INFO(("Sync response does not fit into the cache storage\n"));
+        free(c.data);
+        return WICED_BADARG;
+    }
+
+    header.magic = SR_CACHE_MAGIC;
+    header.version = SR_CACHE_VERSION;
+    header.data_len = (uint16_t) c.pos;
+    header.expires_at = (uint32_t) time(NULL) + ttl_secs;
+    header.checksum = fnv1a(c.data, c.pos);
+
+    // write the data first, so that a power loss can't leave a valid header over partial data
+    wiced_result_t ret = storage->write(storage->ctx, sizeof(header), c.data, c.pos);
+    if (WICED_SUCCESS == ret) {
+        ret = storage->write(storage->ctx, 0, &header, sizeof(header));
+    }
+    free(c.data);
+    return ret;
+}
+
+void iotc_sr_cache_invalidate(IotconnectNvStorage *storage) {
+    IotcSrCacheHeader header;
+    if (!storage || !storage->write || storage->size < sizeof(header)) {
+        return;
+    }
+    memset(&header, 0, sizeof(header));
+    (void) storage->write(storage->ctx, 0, &header, sizeof(header));
+}
+
+wiced_result_t iotc_sr_cache_connect(IotconnectNvStorage *storage, const char *cpid, const char *env,
+                                     const char *duid, uint32_t ttl_secs, IotcSrCacheConnectFn connect_fn,
+                                     IotcSrCacheDiscoverFn discover_fn, void *ctx) {
+    wiced_result_t ret = connect_fn(ctx);
+    if (WICED_BADVALUE != ret) {
+        return ret;
+    }
+    // broker parameters have changed since they were cached
+    WPRINT_LIB_INFO(("The broker rejected the cached sync response. Running discovery...\n"));
+    iotc_sr_cache_invalidate(storage);
+    const IotclSyncResponse *sr = discover_fn(ctx);
+    if (!sr) {
+        return WICED_ERROR;
+    }
+    if (WICED_SUCCESS != iotc_sr_cache_store(storage, cpid, env, duid, sr, ttl_secs)) {
+        WPRINT_LIB_INFO(("Warning: Failed to store the sync response into the cache\n"));
+    }
+    return connect_fn(ctx);
+}
@@ -0,0 +1,44 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#pragma once
+
+#include <wiced.h>
+#include "iotc_sdk.h"
+#include "iotconnect_discovery.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Returns a newly allocated sync response if storage holds a valid entry for cpid/env/duid that is unexpired,
+// or expired but accept_expired is set. Returns NULL otherwise.
+// The result is packed with iotc_sr_arena_pack. Make sure to call iotc_sr_arena_free when done with it.
+IotclSyncResponse *iotc_sr_cache_load(IotconnectNvStorage *storage, const char *cpid, const char *env,
+                                      const char *duid, bool accept_expired);
+
+// Stores the broker parameters and dtg of the sync response, keyed by cpid/env/duid, valid for ttl_secs.
+wiced_result_t iotc_sr_cache_store(IotconnectNvStorage *storage, const char *cpid, const char *env,
+                                   const char *duid, const IotclSyncResponse *sr, uint32_t ttl_secs);
+
+// Marks the stored entry as invalid, so that the next load will fail.
+void iotc_sr_cache_invalidate(IotconnectNvStorage *storage);
+
+// Connects with the current sync response. Returns WICED_BADVALUE if the broker rejected the credentials.
+typedef wiced_result_t (*IotcSrCacheConnectFn)(void *ctx);
+
+// Runs discovery and makes the result the current sync response. Returns it, or NULL if discovery failed.
+typedef const IotclSyncResponse *(*IotcSrCacheDiscoverFn)(void *ctx);
+
+// Connects with a sync response that was loaded from the cache. Only if the broker rejects it, the entry is
+// invalidated and the connection retried with a fresh discovery, whose result replaces the entry.
+// Other failures, like an unreachable broker, keep the entry for the next attempt.
+wiced_result_t iotc_sr_cache_connect(IotconnectNvStorage *storage, const char *cpid, const char *env,
+                                     const char *duid, uint32_t ttl_secs, IotcSrCacheConnectFn connect_fn,
+                                     IotcSrCacheDiscoverFn discover_fn, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
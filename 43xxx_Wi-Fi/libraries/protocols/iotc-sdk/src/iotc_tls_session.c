@@ -0,0 +1,163 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#include <string.h>
+#include "iotc_tls_session.h"
+
+#define TLS_SESSION_MAGIC 0x53534C54 // "TLSS"
+#define TLS_SESSION_VERSION 1
+
+// Only what is needed to resume is kept, so that no pointers from the TLS stack end up in storage.
+typedef struct {
+    uint32_t host_hash; // 0 if the entry is unused
+    uint32_t last_used;
+    int32_t ciphersuite;
+    int32_t id_len;
+    uint8_t id[32];
+    uint8_t master[48];
+} TlsSessionEntry;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t num_entries;
+    uint32_t checksum; // FNV-1a of the entries
+    TlsSessionEntry entries[IOTC_SDK_TLS_SESSION_CACHE_SIZE];
+} TlsSessionStore;
+
+static TlsSessionStore store;
+static IotconnectNvStorage *nv_storage = NULL;
+static uint32_t use_counter = 0;
+static IotconnectTlsStats stats;
+
+static uint32_t fnv1a(const void *data, size_t len) {
+    const uint8_t *p = data;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t host_hash(const char *host) {
+    uint32_t hash = fnv1a(host, strlen(host));
+    return hash ? hash : 1; // 0 marks an unused entry
+}
+
+static TlsSessionEntry *find_entry(const char *host) {
+    if (!host) {
+        return NULL;
+    }
+    uint32_t hash = host_hash(host);
+    for (int i = 0; i < IOTC_SDK_TLS_SESSION_CACHE_SIZE; i++) {
+        if (store.entries[i].host_hash == hash) {
+            return &store.entries[i];
+        }
+    }
+    return NULL;
+}
+
+static void persist(void) {
+    if (!nv_storage || !nv_storage->write) {
+        return;
+    }
+    store.magic = TLS_SESSION_MAGIC;
+    store.version = TLS_SESSION_VERSION;
+    store.num_entries = IOTC_SDK_TLS_SESSION_CACHE_SIZE;
+    store.checksum = fnv1a(store.entries, sizeof(store.entries));
+    if (WICED_SUCCESS != nv_storage->write(nv_storage->ctx, 0, &store, sizeof(store))) {
+        WPRINT_LIB_INFO(("Warning: Unable to persist TLS sessions\n"));
+    }
+}
+
+void iotc_tls_session_init(IotconnectNvStorage *storage) {
+    memset(&store, 0, sizeof(store));
+    use_counter = 0;
+    nv_storage = (storage && storage->size >= sizeof(store)) ? storage : NULL;
+    if (!nv_storage || !nv_storage->read) {
+        return;
+    }
+    if (WICED_SUCCESS != nv_storage->read(nv_storage->ctx, 0, &store, sizeof(store))
+        || store.magic != TLS_SESSION_MAGIC || store.version != TLS_SESSION_VERSION
+        || store.num_entries != IOTC_SDK_TLS_SESSION_CACHE_SIZE
+        || store.checksum != fnv1a(store.entries, sizeof(store.entries))) {
+        memset(&store, 0, sizeof(store));
+        return;
+    }
+    for (int i = 0; i < IOTC_SDK_TLS_SESSION_CACHE_SIZE; i++) {
+        if (store.entries[i].last_used > use_counter) {
+            use_counter = store.entries[i].last_used;
+        }
+    }
+}
+
+void iotc_tls_session_prepare(const char *host, wiced_tls_session_t *session) {
+    memset(session, 0, sizeof(wiced_tls_session_t));
+    TlsSessionEntry *e = find_entry(host);
+    if (!e || e->id_len <= 0 || e->id_len > (int32_t) sizeof(session->id)) {
+        return;
+    }
+    session->ciphersuite = e->ciphersuite;
+    session->length = e->id_len;
+    memcpy(session->id, e->id, sizeof(session->id));
+    memcpy(session->master, e->master, sizeof(session->master));
+}
+
+void iotc_tls_session_save(const char *host, const wiced_tls_session_t *session) {
+    if (!host || !session) {
+        return;
+    }
+    TlsSessionEntry *e = find_entry(host);
+
+    // the server accepted the offered session if it kept its ID and master secret
+    if (e && session->length == e->id_len && session->length > 0
+        && 0 == memcmp(session->id, e->id, (size_t) session->length)
+        && 0 == memcmp(session->master, e->master, sizeof(e->master))) {
+        stats.abbreviated_handshakes++;
+        e->last_used = ++use_counter; // not worth a storage write
+        return;
+    }
+    stats.full_handshakes++;
+    if (session->length <= 0 || session->length > (int32_t) sizeof(session->id)) {
+        // server does not support resumption
+        if (e) {
+            iotc_tls_session_invalidate(host);
+        }
+        return;
+    }
+
+    if (!e) {
+        // replace the least recently used entry
+        e = &store.entries[0];
+        for (int i = 1; i < IOTC_SDK_TLS_SESSION_CACHE_SIZE; i++) {
+            if (store.entries[i].last_used < e->last_used) {
+                e = &store.entries[i];
+            }
+        }
+    }
+    memset(e, 0, sizeof(TlsSessionEntry));
+    e->host_hash = host_hash(host);
+    e->last_used = ++use_counter;
+    e->ciphersuite = session->ciphersuite;
+    e->id_len = session->length;
+    memcpy(e->id, session->id, sizeof(e->id));
+    memcpy(e->master, session->master, sizeof(e->master));
+    persist();
+}
+
+void iotc_tls_session_invalidate(const char *host) {
+    TlsSessionEntry *e = find_entry(host);
+    if (e) {
+        memset(e, 0, sizeof(TlsSessionEntry));
+        persist();
+    }
+}
+
+void iotc_tls_session_get_stats(IotconnectTlsStats *s) {
+    if (s) {
+        *s = stats;
+    }
+}
@@ -0,0 +1,41 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#pragma once
+
+#include <wiced.h>
+#include "wiced_tls.h"
+#include "iotc_sdk.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef IOTC_SDK_TLS_SESSION_CACHE_SIZE
+#define IOTC_SDK_TLS_SESSION_CACHE_SIZE 3 // discovery, agent and one spare
+#endif
+
+// Caches negotiated TLS sessions per host, so that the next connection to the same host
+// can be resumed with an abbreviated handshake instead of a full one.
+
+// Loads sessions persisted in storage, if storage is set. Sessions are persisted to it when they change.
+void iotc_tls_session_init(IotconnectNvStorage *storage);
+
+// Fills session with the cached session for host, or clears it if there is none.
+// Call before the handshake.
+void iotc_tls_session_prepare(const char *host, wiced_tls_session_t *session);
+
+// Records the session negotiated with host and counts the handshake as full or abbreviated.
+// Call after a successful handshake, with the session that was prepared for it.
+void iotc_tls_session_save(const char *host, const wiced_tls_session_t *session);
+
+// Forgets the session for host, for example when a connection with it failed.
+void iotc_tls_session_invalidate(const char *host);
+
+void iotc_tls_session_get_stats(IotconnectTlsStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
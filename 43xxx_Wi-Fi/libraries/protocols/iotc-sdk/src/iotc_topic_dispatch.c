@@ -0,0 +1,112 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "iotc_topic_dispatch.h"
+
+// With only a handful of routes, a table sorted by prefix length is smaller than a trie.
+// Topics share their leading bytes ("devices/..." or "$iothub/..."), so routes are told apart by a full compare.
+typedef struct {
+    char *filter; // as registered
+    size_t prefix_len; // filter length without the trailing "#"
+    bool exact; // filter had no "#" and the topic must match it fully
+    IotconnectTopicHandler handler;
+    void *ctx;
+} TopicRoute;
+
+static TopicRoute routes[IOTC_SDK_MAX_TOPIC_HANDLERS];
+static int num_routes = 0;
+
+wiced_result_t iotc_topic_dispatch_add(const char *topic_filter, IotconnectTopicHandler handler, void *ctx) {
+    if (!topic_filter || strchr(topic_filter, '+')) {
+        return WICED_BADARG;
+    }
+    size_t filter_len = strlen(topic_filter);
+    char *hash = strchr(topic_filter, '#');
+    if (hash && hash != &topic_filter[filter_len - 1]) {
+        return WICED_BADARG; // "#" is only valid at the end
+    }
+    size_t prefix_len = hash ? filter_len - 1 : filter_len;
+    if (0 == prefix_len) {
+        return WICED_BADARG; // would match everything
+    }
+    if (num_routes >= IOTC_SDK_MAX_TOPIC_HANDLERS) {
+        return WICED_OUT_OF_HEAP_SPACE;
+    }
+
+    TopicRoute *r = &routes[num_routes];
+    r->filter = malloc(filter_len + 1);
+    if (!r->filter) {
+        return WICED_OUT_OF_HEAP_SPACE;
+    }
+    memcpy(r->filter, topic_filter, filter_len + 1);
+    r->prefix_len = prefix_len;
+    r->exact = (NULL == hash);
+    r->handler = handler;
+    r->ctx = ctx;
+    num_routes++;
+    return WICED_SUCCESS;
+}
+
+static bool is_covered_by(const char *filter, const char *device_bound_filter) {
+    if (!device_bound_filter) {
+        return false;
+    }
+    size_t len = strlen(device_bound_filter);
+    if (len > 0 && device_bound_filter[len - 1] == '#') {
+        return 0 == strncmp(filter, device_bound_filter, len - 1);
+    }
+    return 0 == strcmp(filter, device_bound_filter);
+}
+
+int iotc_topic_dispatch_build(const char *device_bound_filter, char **subscriptions, int max_subscriptions) {
+    int num_subscriptions = 0;
+
+    // insertion sort, longest prefix first, so that the first match is the most specific one
+    for (int i = 1; i < num_routes; i++) {
+        TopicRoute r = routes[i];
+        int j = i - 1;
+        while (j >= 0 && routes[j].prefix_len < r.prefix_len) {
+            routes[j + 1] = routes[j];
+            j--;
+        }
+        routes[j + 1] = r;
+    }
+
+    for (int i = 0; i < num_routes; i++) {
+        if (num_subscriptions < max_subscriptions && !is_covered_by(routes[i].filter, device_bound_filter)) {
+            subscriptions[num_subscriptions++] = routes[i].filter;
+        }
+    }
+    return num_subscriptions;
+}
+
+bool iotc_topic_dispatch(const uint8_t *topic, size_t topic_len, const uint8_t *data, size_t len) {
+    if (0 == num_routes || 0 == topic_len) {
+        return false;
+    }
+    for (int i = 0; i < num_routes; i++) {
+        TopicRoute *r = &routes[i];
+        if (topic_len < r->prefix_len || (r->exact && topic_len != r->prefix_len)) {
+            continue;
+        }
+        if (0 == memcmp(topic, r->filter, r->prefix_len)) {
+            if (r->handler) {
+                r->handler(topic, topic_len, data, len, r->ctx);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void iotc_topic_dispatch_clear(void) {
+    for (int i = 0; i < num_routes; i++) {
+        free(routes[i].filter);
+    }
+    memset(routes, 0, sizeof(routes));
+    num_routes = 0;
+}
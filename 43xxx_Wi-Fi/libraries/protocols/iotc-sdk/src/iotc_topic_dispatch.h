@@ -0,0 +1,38 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#pragma once
+
+#include <wiced.h>
+#include "iotc_sdk.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Routes inbound messages to handlers by topic before any JSON parsing takes place.
+// Routes are registered up front and the lookup table is built once, when the SDK subscribes.
+
+#ifndef IOTC_SDK_MAX_TOPIC_HANDLERS
+#define IOTC_SDK_MAX_TOPIC_HANDLERS 8
+#endif
+
+// topic_filter is either an exact topic or a prefix ending with "#". Other wildcards are not supported.
+// handler may be NULL to silently drop the matching messages.
+wiced_result_t iotc_topic_dispatch_add(const char *topic_filter, IotconnectTopicHandler handler, void *ctx);
+
+// Sorts the routes for longest prefix matching, so that the most specific route matches first.
+// Filters that are not covered by device_bound_filter are returned in subscriptions, up to max_subscriptions.
+// Returns the number of filters written into subscriptions.
+int iotc_topic_dispatch_build(const char *device_bound_filter, char **subscriptions, int max_subscriptions);
+
+// Returns true if the message was matched by a route (and handled or dropped).
+bool iotc_topic_dispatch(const uint8_t *topic, size_t topic_len, const uint8_t *data, size_t len);
+
+void iotc_topic_dispatch_clear(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -4,6 +4,7 @@
 //
 
 #include "iotc_wiced_discovery.h"
+#include "iotc_tls_session.h"
 #include "cert/iotconnect_api_certs.h"
 
 #include <stdlib.h>
@@ -22,6 +23,7 @@ static char data_buff[RECEIVE_BUFFER_MAX_SIZE];
 static http_client_t client;
 static http_request_t request;
 static wiced_semaphore_t semaphore;
+static wiced_tls_session_t tls_session;
 
 // forward declarations -----------
 static void synchronous_rest_call(const char *host, const char *path,
@@ -132,13 +134,19 @@ void synchronous_rest_call(const char *host, const char *path,
     /* if you set hostname, library will make sure subject name in the server certificate is matching with host name you are trying to connect. pass NULL if you don't want to enable this check */
     client.peer_cn = (uint8_t *) host;
 
+    // offer the last session with this host, so that the handshake can be abbreviated
+    iotc_tls_session_prepare(host, &tls_session);
+    client.tls_session = &tls_session;
+
     if ((result = http_client_connect(&client,
                                       (const wiced_ip_address_t *) &ip_address, PORT, HTTP_USE_TLS,
                                       CONNECT_TIMEOUT_MS)) != WICED_SUCCESS) {
         WPRINT_LIB_INFO(("Error: failed to connect to server: %u\n", result));
+        iotc_tls_session_invalidate(host);
         data_buff[0] = 0; // clear the data buffer
         return;
     }
+    iotc_tls_session_save(host, &tls_session);
 
     WPRINT_LIB_INFO(("Connected\n"));
 
@@ -43,6 +43,8 @@
 #include <wiced.h>
 #include <mqtt_api.h>
 #include "iotc_wiced_mqtt.h"
+#include "iotc_keepalive.h"
+#include "iotc_worker.h"
 
 #define DEFAULT_MQTT_TIMEOUT_MS 10000
 
@@ -50,84 +52,288 @@
 #define IOTC_SDK_RESOLVE_TIMEOUT_MS 10000
 #endif
 
-#ifndef IOTC_SDK_KEEPALIVE_INTERVAL_SECS
-#define IOTC_SDK_KEEPALIVE_INTERVAL_SECS 30
+#ifndef IOTC_SDK_RECONNECT_MIN_BACKOFF_MS
+#define IOTC_SDK_RECONNECT_MIN_BACKOFF_MS 1000
 #endif
 
-static wiced_result_t mqtt_connection_event_cb(wiced_mqtt_object_t mqtt_object, wiced_mqtt_event_info_t *event);
+#ifndef IOTC_SDK_RECONNECT_MAX_BACKOFF_MS
+#define IOTC_SDK_RECONNECT_MAX_BACKOFF_MS 60000
+#endif
+
+// The broker address is resolved once and reused. Resolve again after this many failed reconnects in a row.
+#ifndef IOTC_SDK_RECONNECT_RESOLVE_AFTER_FAILURES
+#define IOTC_SDK_RECONNECT_RESOLVE_AFTER_FAILURES 5
+#endif
+
+#ifndef IOTC_SDK_INFLIGHT_CHECK_INTERVAL_MS
+#define IOTC_SDK_INFLIGHT_CHECK_INTERVAL_MS 500
+#endif
+
+#define DEFAULT_MAX_RETRANSMITS 2
+
+typedef struct PendingRequest PendingRequest;
+
+// Requests waiting for an acknowledgement, keyed by event type and packet ID, so that several threads
+// can wait for their own CONNACK, SUBACK or UNSUBACK at the same time.
+// PUBACKs complete the in-flight table instead, which reports them through the publish callbacks.
+struct PendingRequest {
+    bool in_use;
+    bool completed;
+    wiced_mqtt_event_type_t event;
+    wiced_mqtt_msgid_t msgid; // 0 for CONNACK
+    wiced_result_t result;
+    wiced_semaphore_t semaphore;
+};
+
+// QoS1 messages waiting for PUBACK
+typedef struct {
+    wiced_mqtt_msgid_t msgid; // 0 if the slot is free
+    bool reserved; // claimed by a publish that has not returned its packet ID yet
+    bool resending; // being published again without the lock. Not released until the resend returns
+    bool acked; // the PUBACK of msgid arrived while resending
+    uint8_t retransmits;
+    uint8_t flags; // IOTC_PUBLISH_FLAG_*
+    wiced_time_t first_sent_at;
+    wiced_time_t sent_at;
+    uint8_t *data; // copy for retransmission. NULL if retransmission is disabled
+    size_t len;
+    IotconnectPublishCallback cb;
+    void *ctx;
+} InflightEntry;
 
-static wiced_result_t mqtt_wait_for(wiced_mqtt_event_type_t event, uint32_t timeout);
+struct IotcMqttClient {
+    // Must stay the first member. The WICED event callback only gets the mqtt object,
+    // and its address is the address of the client.
+    uint8_t mqtt_object[WICED_MQTT_OBJECT_MEMORY_SIZE_REQUIREMENT];
+    IotconnectMqttConfig *config;
+    bool is_connected;
+    bool session_present; // from the last CONNACK
+
+    wiced_ip_address_t broker_address;
+    bool broker_resolved;
+    wiced_mqtt_security_t *mqtt_security;
+    IotcKeepalive *keepalive;
+    IotcKeepalive own_keepalive; // used if the config doesn't provide one
+
+    PendingRequest pending[IOTC_SDK_MAX_PENDING_REQUESTS];
+    wiced_mutex_t pending_mutex;
+
+    // reconnect state. Reconnects are attempted on the SDK worker thread, or by iotc_wiced_mqtt_poll.
+    // The in-flight check runs on the link worker at the same time, and leaves the reconnect state alone.
+    wiced_timed_event_t reconnect_event;
+    wiced_time_t reconnect_at; // poll mode only
+    bool reconnect_enabled; // false if the user requested the disconnect
+    bool reconnect_scheduled;
+    bool reconnect_in_progress;
+    uint32_t reconnect_backoff_ms;
+    uint32_t reconnect_failures; // consecutive
+    wiced_time_t disconnected_at;
+    IotconnectReconnectStats reconnect_stats;
+
+    InflightEntry inflight[IOTC_SDK_MAX_INFLIGHT];
+    uint32_t inflight_count; // including reserved slots
+    // PUBACKs that arrived while a publish or a resend was still waiting for its packet ID
+    wiced_mqtt_msgid_t early_acks[IOTC_SDK_MAX_INFLIGHT];
+    uint32_t num_early_acks;
+    wiced_mutex_t inflight_mutex;
+    wiced_timed_event_t inflight_check_event;
+    bool inflight_check_registered;
+    wiced_time_t inflight_check_at; // poll_mode or inflight_check_polled only
+    volatile bool retransmit_pending; // inflight_check_polled: reconnected, and nothing was retransmitted yet
+    IotconnectPublishStats publish_stats;
+
+    // set by iotc_wiced_mqtt_destroy. Events of the client that run afterwards return right away.
+    volatile bool closing;
+};
+
+// The SDK worker runs reconnects and the link worker runs in-flight checks (see iotc_worker.h).
+// Each client holds a reference to both. Clients must be created and destroyed from one thread at a time.
+static wiced_worker_thread_t *sdk_worker = NULL;
+static wiced_worker_thread_t *link_worker = NULL;
+
+static const uint32_t latency_buckets[] = IOTC_SDK_PUBACK_LATENCY_BUCKETS;
+
+static wiced_result_t mqtt_connection_event_cb(wiced_mqtt_object_t mqtt_object, wiced_mqtt_event_info_t *event);
 
 wiced_result_t mqtt_conn_open(
+        IotcMqttClient *client,
         const char *client_id,
         const char *username,
         const char *password,
         int keepalive_secs,
-        wiced_mqtt_object_t mqtt_obj,
+        bool clean_session,
         wiced_ip_address_t *address,
         wiced_interface_t interface,
         wiced_mqtt_callback_t callback,
         wiced_mqtt_security_t *security
 );
 
-static wiced_result_t mqtt_sdk_subscribe(wiced_mqtt_object_t mqtt_obj, char *topic, uint8_t qos);
+static PendingRequest *mqtt_sdk_subscribe(IotcMqttClient *client, char *topic, uint8_t qos);
 
-static wiced_result_t mqtt_sdk_unsubscribe(wiced_mqtt_object_t mqtt_obj, char *topic);
+static wiced_result_t mqtt_sdk_unsubscribe(IotcMqttClient *client, char *topic);
 
-static wiced_result_t
-mqtt_sdk_publish(wiced_mqtt_object_t mqtt_obj, uint8_t qos, char *topic, uint8_t *data, uint32_t data_len);
+static wiced_mqtt_msgid_t
+mqtt_sdk_publish(IotcMqttClient *client, uint8_t qos, char *topic, uint8_t *data, uint32_t data_len);
 
+static void schedule_reconnect(IotcMqttClient *client);
+
+static void on_puback(IotcMqttClient *client, wiced_mqtt_msgid_t msgid);
+
+static void retransmit_all_inflight(IotcMqttClient *client);
+
+static char *publish_topic(IotcMqttClient *client, uint8_t flags) {
+    if ((flags & IOTC_PUBLISH_FLAG_COMPRESSED) && client->config->compressed_pub_topic) {
+        return client->config->compressed_pub_topic;
+    }
+    return client->config->sr->broker.pub_topic;
+}
+
+static void pending_init(IotcMqttClient *client) {
+    memset(client->pending, 0, sizeof(client->pending));
+    for (int i = 0; i < IOTC_SDK_MAX_PENDING_REQUESTS; i++) {
+        wiced_rtos_init_semaphore(&client->pending[i].semaphore);
+    }
+    wiced_rtos_init_mutex(&client->pending_mutex);
+}
+
+static void pending_deinit(IotcMqttClient *client) {
+    for (int i = 0; i < IOTC_SDK_MAX_PENDING_REQUESTS; i++) {
+        wiced_rtos_deinit_semaphore(&client->pending[i].semaphore);
+    }
+    wiced_rtos_deinit_mutex(&client->pending_mutex);
+}
+
+// Must be called with pending_mutex held. Returns NULL if the table is full.
+static PendingRequest *pending_add(IotcMqttClient *client, wiced_mqtt_event_type_t event, wiced_mqtt_msgid_t msgid) {
+    for (int i = 0; i < IOTC_SDK_MAX_PENDING_REQUESTS; i++) {
+        PendingRequest *r = &client->pending[i];
+        if (!r->in_use) {
+            r->in_use = true;
+            r->completed = false;
+            r->event = event;
+            r->msgid = msgid;
+            r->result = WICED_TIMEOUT;
+            return r;
+        }
+    }
+    WPRINT_LIB_INFO(("[MQTT] Too many pending requests\n"));
+    return NULL;
+}
+
+static void pending_complete(IotcMqttClient *client, wiced_mqtt_event_type_t event, wiced_mqtt_msgid_t msgid,
+                             wiced_result_t result) {
+    wiced_rtos_lock_mutex(&client->pending_mutex);
+    for (int i = 0; i < IOTC_SDK_MAX_PENDING_REQUESTS; i++) {
+        PendingRequest *r = &client->pending[i];
+        if (r->in_use && !r->completed && r->event == event && r->msgid == msgid) {
+            r->completed = true;
+            r->result = result;
+            wiced_rtos_set_semaphore(&r->semaphore);
+            break;
+        }
+    }
+    wiced_rtos_unlock_mutex(&client->pending_mutex);
+}
 
-static wiced_mqtt_object_t mqtt_object;
-static IotconnectMqttConfig *config;
-static bool is_connected = false;
+// The connection is gone, so no acknowledgement will arrive
+static void pending_fail_all(IotcMqttClient *client, wiced_result_t result) {
+    wiced_rtos_lock_mutex(&client->pending_mutex);
+    for (int i = 0; i < IOTC_SDK_MAX_PENDING_REQUESTS; i++) {
+        PendingRequest *r = &client->pending[i];
+        if (r->in_use && !r->completed) {
+            r->completed = true;
+            r->result = result;
+            wiced_rtos_set_semaphore(&r->semaphore);
+        }
+    }
+    wiced_rtos_unlock_mutex(&client->pending_mutex);
+}
 
-static wiced_ip_address_t broker_address;
-static wiced_mqtt_event_type_t expected_event;
-static wiced_semaphore_t semaphore;
+// Waits for the request to complete and releases it. A NULL request is treated as failed.
+static wiced_result_t pending_wait(IotcMqttClient *client, PendingRequest *r, uint32_t timeout) {
+    if (!r) {
+        return WICED_ERROR;
+    }
+    wiced_result_t ret = wiced_rtos_get_semaphore(&r->semaphore, timeout);
+    wiced_rtos_lock_mutex(&client->pending_mutex);
+    if (WICED_SUCCESS != ret && r->completed) {
+        // completed right after the timeout. Consume the signal, so it doesn't leak into the next request
+        (void) wiced_rtos_get_semaphore(&r->semaphore, 0);
+    }
+    ret = r->completed ? r->result : WICED_TIMEOUT;
+    r->in_use = false;
+    wiced_rtos_unlock_mutex(&client->pending_mutex);
+    return ret;
+}
 
+// True if the broker refused the credentials or the client ID, rather than being unavailable for the moment
+static bool is_connack_rejection(wiced_mqtt_conn_ack_code_t code) {
+    return code == WICED_MQTT_CONN_ERR_CODE_IDENTIFIER_REJECTED
+           || code == WICED_MQTT_CONN_ERR_CODE_BAD_USR_OR_PWD
+           || code == WICED_MQTT_CONN_ERR_CODE_NOT_AUTHORIZED;
+}
 
 /*
  * Callback function to handle connection events.
  */
 static wiced_result_t mqtt_connection_event_cb(wiced_mqtt_object_t mqtt_object, wiced_mqtt_event_info_t *event) {
+    IotcMqttClient *client = (IotcMqttClient *) mqtt_object;
+    IotconnectMqttConfig *config = client->config;
     //WPRINT_LIB_INFO(("[MQTT]: event: %d\n", event->type));
+    if (event->type != WICED_MQTT_EVENT_TYPE_DISCONNECTED) {
+        iotc_keepalive_on_inbound(client->keepalive);
+    }
 
     switch (event->type) {
-        case WICED_MQTT_EVENT_TYPE_CONNECT_REQ_STATUS:
-            expected_event = event->type;
-            wiced_rtos_set_semaphore(&semaphore);
+        case WICED_MQTT_EVENT_TYPE_CONNECT_REQ_STATUS: {
+            wiced_result_t result = WICED_SUCCESS;
             if (event->data.conn_ack.err_code != WICED_MQTT_CONN_ERR_CODE_NONE) {
-                is_connected = true;
+                client->is_connected = false;
                 WPRINT_LIB_INFO(("[MQTT] Connection Error code: %d\n", event->data.conn_ack.err_code));
-                config->status_cb(MQTT_FAILED, NULL);
+                result = is_connack_rejection(event->data.conn_ack.err_code) ? WICED_BADVALUE : WICED_ERROR;
+                config->status_cb(MQTT_FAILED, NULL, config->cb_ctx);
             } else {
-                is_connected = false;
-                config->status_cb(MQTT_CONNECTED, NULL);
+                client->is_connected = true;
+                client->session_present = (0 != event->data.conn_ack.session_present);
+                iotc_keepalive_on_connected(client->keepalive);
+                config->status_cb(MQTT_CONNECTED, NULL, config->cb_ctx);
             }
+            pending_complete(client, event->type, 0, result);
             break;
-        case WICED_MQTT_EVENT_TYPE_DISCONNECTED:
-            is_connected = false;
-            config->status_cb(MQTT_DISCONNECTED, NULL);
+        }
+        case WICED_MQTT_EVENT_TYPE_DISCONNECTED: {
+            bool was_connected = client->is_connected;
+            client->is_connected = false;
+            config->status_cb(MQTT_DISCONNECTED, NULL, config->cb_ctx);
+            pending_fail_all(client, WICED_NOTUP);
+            // a failed reconnect attempt will reschedule itself
+            if (client->reconnect_enabled && was_connected && !client->reconnect_in_progress) {
+                iotc_keepalive_on_connection_lost(client->keepalive);
+                wiced_time_get_time(&client->disconnected_at);
+                client->reconnect_stats.disconnects++;
+                client->reconnect_backoff_ms = 0;
+                client->reconnect_failures = 0;
+                schedule_reconnect(client);
+            }
             break;
+        }
         case WICED_MQTT_EVENT_TYPE_PUBLISHED:
             WPRINT_LIB_INFO(("[MQTT]: Packet ID %u acknowledged.\n", event->data.msgid));
-            expected_event = event->type;
-            config->status_cb(MQTT_PUBLISHED, &event->data.msgid);
+            on_puback(client, event->data.msgid);
+            config->status_cb(MQTT_PUBLISHED, &event->data.msgid, config->cb_ctx);
             break;
         case WICED_MQTT_EVENT_TYPE_SUBSCRIBED:
-            expected_event = event->type;
-            wiced_rtos_set_semaphore(&semaphore);
+            pending_complete(client, event->type, event->data.msgid, WICED_SUCCESS);
             break;
         case WICED_MQTT_EVENT_TYPE_PUBLISH_MSG_RECEIVED: {
             wiced_mqtt_topic_msg_t msg = event->data.pub_recvd;
-            WPRINT_LIB_INFO(
-                    ("[MQTT] Received %.*s  for TOPIC : %.*s\n\n", (int) msg.data_len, msg.data, (int) msg.topic_len, msg.topic));
-            config->data_cb(msg.data, msg.data_len, msg.topic, msg.topic_len);
+            WPRINT_LIB_INFO(("[MQTT] Received %lu bytes\n", (unsigned long) msg.data_len));
+            config->data_cb(msg.data, msg.data_len, msg.topic, msg.topic_len, config->cb_ctx);
             break;
         }
         case WICED_MQTT_EVENT_TYPE_UNSUBSCRIBED:
             WPRINT_LIB_INFO(("[MQTT]: Unsubscribed.\n"));
+            pending_complete(client, event->type, event->data.msgid, WICED_SUCCESS);
             break;
         default:
             break;
@@ -135,26 +341,17 @@ static wiced_result_t mqtt_connection_event_cb(wiced_mqtt_object_t mqtt_object,
     return WICED_SUCCESS;
 }
 
-static wiced_result_t mqtt_wait_for(wiced_mqtt_event_type_t event, uint32_t timeout) {
-    if (wiced_rtos_get_semaphore(&semaphore, timeout) != WICED_SUCCESS) {
-        return WICED_ERROR;
-    } else {
-        if (event != expected_event) {
-            return WICED_ERROR;
-        }
-    }
-    return WICED_SUCCESS;
-}
-
 /*
- * Open a connection and wait for config->mqtt_timeout_ms * 2 period to receive a connection open OK event
+ * Open a connection and wait for config->mqtt_timeout_ms * 2 period to receive a connection open OK event.
+ * Returns WICED_BADVALUE if the broker rejected the credentials or the client ID.
  */
 wiced_result_t mqtt_conn_open(
+        IotcMqttClient *client,
         const char *client_id,
         const char *username,
         const char *password,
         int keepalive_secs,
-        wiced_mqtt_object_t mqtt_obj,
+        bool clean_session,
         wiced_ip_address_t *address,
         wiced_interface_t interface,
         wiced_mqtt_callback_t callback,
@@ -162,80 +359,586 @@ wiced_result_t mqtt_conn_open(
 ) {
     wiced_mqtt_pkt_connect_t conninfo;
     wiced_result_t ret = WICED_SUCCESS;
+    PendingRequest *request;
 
     memset(&conninfo, 0, sizeof(conninfo));
 
     conninfo.port_number = 8883;                   /* set to 0 indicates library to use default settings */
     conninfo.mqtt_version = WICED_MQTT_PROTOCOL_VER4;
-    conninfo.clean_session = 1;
+    conninfo.clean_session = clean_session ? 1 : 0;
     conninfo.client_id = (uint8_t *) client_id;
     conninfo.keep_alive = keepalive_secs;
     conninfo.password = (uint8_t *) password;
     conninfo.username = (uint8_t *) username;
     conninfo.peer_cn = (uint8_t *) "*.azure-devices.net";
 
-    ret = wiced_mqtt_connect(mqtt_obj, address, interface, callback, security, &conninfo);
+    // CONNACK has no packet ID, so the request can be registered before connecting
+    wiced_rtos_lock_mutex(&client->pending_mutex);
+    request = pending_add(client, WICED_MQTT_EVENT_TYPE_CONNECT_REQ_STATUS, 0);
+    wiced_rtos_unlock_mutex(&client->pending_mutex);
+    if (!request) {
+        return WICED_ERROR;
+    }
+
+    ret = wiced_mqtt_connect(client->mqtt_object, address, interface, callback, security, &conninfo);
     if (ret != WICED_SUCCESS) {
+        (void) pending_wait(client, request, 0); // releases the request
         return WICED_ERROR;
     }
-    if (mqtt_wait_for(WICED_MQTT_EVENT_TYPE_CONNECT_REQ_STATUS, config->mqtt_timeout_ms * 2) != WICED_SUCCESS) {
+    // fails as well if CONNACK was received, but the broker rejected the connection
+    ret = pending_wait(client, request, client->config->mqtt_timeout_ms * 2);
+    if (ret != WICED_SUCCESS && ret != WICED_BADVALUE) {
         return WICED_ERROR;
     }
-    return WICED_SUCCESS;
+    return ret;
 }
 
 /*
- * Subscribe to WICED_TOPIC and wait for 5 seconds to receive an ACM.
+ * Send a SUBSCRIBE and return the request to wait on with pending_wait, or NULL on failure.
+ * Several subscribes can be sent before waiting, so that their round trips overlap.
  */
-static wiced_result_t mqtt_sdk_subscribe(wiced_mqtt_object_t mqtt_obj, char *topic, uint8_t qos) {
+static PendingRequest *mqtt_sdk_subscribe(IotcMqttClient *client, char *topic, uint8_t qos) {
     wiced_mqtt_msgid_t pktid;
-    pktid = wiced_mqtt_subscribe(mqtt_obj, topic, qos);
-    if (pktid == 0) {
-        return WICED_ERROR;
-    }
-    if (mqtt_wait_for(WICED_MQTT_EVENT_TYPE_SUBSCRIBED, config->mqtt_timeout_ms) != WICED_SUCCESS) {
-        return WICED_ERROR;
+    PendingRequest *request = NULL;
+    // The lock is held while sending, so that a quick SUBACK can't arrive before the request is recorded
+    wiced_rtos_lock_mutex(&client->pending_mutex);
+    pktid = wiced_mqtt_subscribe(client->mqtt_object, topic, qos);
+    if (pktid != 0) {
+        iotc_keepalive_on_outbound(client->keepalive);
+        request = pending_add(client, WICED_MQTT_EVENT_TYPE_SUBSCRIBED, pktid);
     }
-    return WICED_SUCCESS;
+    wiced_rtos_unlock_mutex(&client->pending_mutex);
+    return request;
 }
 
 /*
- * Unsubscribe from WICED_TOPIC and wait for 10 seconds to receive an ACM.
+ * Unsubscribe from the topic and wait for the UNSUBACK if connected.
  */
-static wiced_result_t mqtt_sdk_unsubscribe(wiced_mqtt_object_t mqtt_obj, char *topic) {
+static wiced_result_t mqtt_sdk_unsubscribe(IotcMqttClient *client, char *topic) {
     wiced_mqtt_msgid_t pktid;
-    pktid = wiced_mqtt_unsubscribe(mqtt_obj, topic);
+    PendingRequest *request = NULL;
+    wiced_rtos_lock_mutex(&client->pending_mutex);
+    pktid = wiced_mqtt_unsubscribe(client->mqtt_object, topic);
+    if (pktid != 0 && client->is_connected) {
+        request = pending_add(client, WICED_MQTT_EVENT_TYPE_UNSUBSCRIBED, pktid);
+    }
+    wiced_rtos_unlock_mutex(&client->pending_mutex);
 
     if (pktid == 0) {
-        WPRINT_LIB_INFO(("[MQTT]: Unable to subscribe subscribe\n"));
+        WPRINT_LIB_INFO(("[MQTT]: Unable to unsubscribe\n"));
         return WICED_ERROR;
     }
+    if (request) {
+        return pending_wait(client, request, client->config->mqtt_timeout_ms);
+    }
     return WICED_SUCCESS;
 }
 
 /*
- * Publish (send) WICED_MESSAGE_STR to WICED_TOPIC and wait for 5 seconds to receive a PUBCOMP (as it is QoS=2).
+ * Publish data to the topic at the given QoS. Returns the packet ID, without waiting for the PUBACK.
  */
 static wiced_mqtt_msgid_t
-mqtt_sdk_publish(wiced_mqtt_object_t mqtt_obj, uint8_t qos, char *topic, uint8_t *data, uint32_t data_len) {
+mqtt_sdk_publish(IotcMqttClient *client, uint8_t qos, char *topic, uint8_t *data, uint32_t data_len) {
     wiced_mqtt_msgid_t pktid;
-    pktid = wiced_mqtt_publish(mqtt_obj, topic, data, data_len, qos);
+    pktid = wiced_mqtt_publish(client->mqtt_object, topic, data, data_len, qos);
 
     if (pktid == 0) {
         WPRINT_LIB_INFO(("[MQTT]: Publish failed\n"));
+    } else {
+        iotc_keepalive_on_outbound(client->keepalive);
     }
     return pktid;
 }
 
-wiced_result_t
-iotc_wiced_mqtt_init(IotconnectMqttConfig *_config, wiced_mqtt_security_t *security) {
+static wiced_result_t resolve_broker(IotcMqttClient *client) {
+    wiced_ip_address_t *address = &client->broker_address;
+    wiced_result_t ret = wiced_hostname_lookup(client->config->sr->broker.host, address, IOTC_SDK_RESOLVE_TIMEOUT_MS,
+                                               WICED_STA_INTERFACE);
+    if (ret == WICED_ERROR || address->ip.v4 == 0) {
+        WPRINT_LIB_INFO(("[MQTT] Error in resolving DNS\n"));
+        return WICED_ERROR;
+    }
+    client->broker_resolved = true;
+
+    WPRINT_LIB_INFO(("[MQTT] Resolved Broker IP: %u.%u.%u.%u\n", (uint8_t)(GET_IPV4_ADDRESS(*address) >> 24),
+            (uint8_t)(GET_IPV4_ADDRESS(*address) >> 16),
+            (uint8_t)(GET_IPV4_ADDRESS(*address) >> 8),
+            (uint8_t)(GET_IPV4_ADDRESS(*address) >> 0)));
+    return WICED_SUCCESS;
+}
+
+/*
+ * Connect to the resolved broker address and subscribe to the devicebound topic.
+ */
+static wiced_result_t mqtt_connect_and_subscribe(IotcMqttClient *client) {
+    IotconnectMqttConfig *config = client->config;
+    wiced_result_t ret = mqtt_conn_open(
+            client,
+            config->sr->broker.client_id,
+            config->sr->broker.user_name,
+            config->sr->broker.pass,
+            iotc_keepalive_get_interval(client->keepalive),
+            !config->persistent_session,
+            &client->broker_address,
+            WICED_STA_INTERFACE,
+            mqtt_connection_event_cb,
+            client->mqtt_security
+    );
+
+    if (WICED_SUCCESS != ret) {
+        WPRINT_LIB_INFO(("[MQTT] Failed to initialize MQTT connection\n"));
+        return ret;
+    }
+
+    if (config->persistent_session && client->session_present) {
+        // the broker kept our subscriptions
+        WPRINT_LIB_INFO(("[MQTT] Session resumed\n"));
+        client->reconnect_stats.sessions_resumed++;
+        return WICED_SUCCESS;
+    }
+
+    // send all subscribes first and then wait for all of them
+    PendingRequest *requests[1 + IOTC_SDK_MAX_TOPIC_HANDLERS];
+    int num_requests = 0;
+    requests[num_requests++] = mqtt_sdk_subscribe(client, config->sr->broker.sub_topic,
+                                                  WICED_MQTT_QOS_DELIVER_AT_LEAST_ONCE);
+    for (int i = 0; i < config->num_extra_sub_topics && i < IOTC_SDK_MAX_TOPIC_HANDLERS; i++) {
+        requests[num_requests++] = mqtt_sdk_subscribe(client, config->extra_sub_topics[i],
+                                                      WICED_MQTT_QOS_DELIVER_AT_LEAST_ONCE);
+    }
+    for (int i = 0; i < num_requests; i++) {
+        if (WICED_SUCCESS != pending_wait(client, requests[i], config->mqtt_timeout_ms) && WICED_SUCCESS == ret) {
+            WPRINT_LIB_INFO(("[MQTT] Failed subscribe to %s\n",
+                    i == 0 ? config->sr->broker.sub_topic : config->extra_sub_topics[i - 1]));
+            ret = WICED_ERROR;
+        }
+    }
+    if (WICED_SUCCESS != ret) {
+        wiced_mqtt_disconnect(client->mqtt_object);
+        client->is_connected = false;
+    }
+    return ret;
+}
+
+static wiced_result_t reconnect_handler(void *arg) {
+    IotcMqttClient *client = (IotcMqttClient *) arg;
+    IotconnectReconnectStats *stats = &client->reconnect_stats;
+    if (client->closing) {
+        return WICED_SUCCESS; // dispatched before destroy deregistered it
+    }
+    if (!client->config->poll_mode) {
+        // timed events are periodic. We want a one-shot.
+        wiced_rtos_deregister_timed_event(&client->reconnect_event);
+    }
+    client->reconnect_scheduled = false;
+    if (!client->reconnect_enabled || client->is_connected) {
+        return WICED_SUCCESS;
+    }
+
+    client->reconnect_in_progress = true;
+    stats->attempts++;
+    if (!client->broker_resolved || (client->reconnect_failures > 0
+        && 0 == client->reconnect_failures % IOTC_SDK_RECONNECT_RESOLVE_AFTER_FAILURES)) {
+        (void) resolve_broker(client); // on failure, keep using the previous address
+    }
+    wiced_result_t ret = client->broker_resolved ? mqtt_connect_and_subscribe(client) : WICED_ERROR;
+    client->reconnect_in_progress = false;
+
+    if (WICED_SUCCESS == ret) {
+        wiced_time_t now;
+        wiced_time_get_time(&now);
+        uint32_t latency = now - client->disconnected_at;
+        stats->reconnects++;
+        stats->last_latency_ms = latency;
+        stats->total_latency_ms += latency;
+        if (latency > stats->max_latency_ms) {
+            stats->max_latency_ms = latency;
+        }
+        client->reconnect_failures = 0;
+        client->reconnect_backoff_ms = 0;
+        WPRINT_LIB_INFO(("[MQTT] Reconnected after %lu ms\n", (unsigned long) latency));
+        if (client->config->inflight_check_polled) {
+            client->retransmit_pending = true; // picked up by the next iotc_wiced_mqtt_check_inflight
+        } else {
+            retransmit_all_inflight(client);
+        }
+    } else {
+        client->reconnect_failures++;
+        if (client->reconnect_enabled) {
+            schedule_reconnect(client);
+        }
+    }
+    return WICED_SUCCESS;
+}
+
+/*
+ * Schedule the next reconnect attempt with exponential backoff. The delay is randomized between half and full backoff
+ * so that many devices that lost the same access point don't hit the broker all at once.
+ */
+static void schedule_reconnect(IotcMqttClient *client) {
+    if (client->reconnect_scheduled || client->closing) {
+        return;
+    }
+    if (0 == client->reconnect_backoff_ms) {
+        client->reconnect_backoff_ms = IOTC_SDK_RECONNECT_MIN_BACKOFF_MS;
+    } else {
+        client->reconnect_backoff_ms *= 2;
+        if (client->reconnect_backoff_ms > IOTC_SDK_RECONNECT_MAX_BACKOFF_MS) {
+            client->reconnect_backoff_ms = IOTC_SDK_RECONNECT_MAX_BACKOFF_MS;
+        }
+    }
+    uint32_t random = 0;
+    (void) wiced_crypto_get_random(&random, sizeof(random));
+    uint32_t delay = client->reconnect_backoff_ms / 2 + random % (client->reconnect_backoff_ms / 2 + 1);
+
+    WPRINT_LIB_INFO(("[MQTT] Reconnecting in %lu ms\n", (unsigned long) delay));
+    if (client->config->poll_mode) {
+        wiced_time_get_time(&client->reconnect_at);
+        client->reconnect_at += delay;
+        client->reconnect_scheduled = true;
+        return;
+    }
+    if (WICED_SUCCESS != wiced_rtos_register_timed_event(&client->reconnect_event, sdk_worker, reconnect_handler,
+                                                         delay, client)) {
+        WPRINT_LIB_INFO(("[MQTT] Failed to schedule a reconnect\n"));
+        return;
+    }
+    client->reconnect_scheduled = true;
+}
+
+static void cancel_reconnect(IotcMqttClient *client) {
+    client->reconnect_enabled = false;
+    if (client->reconnect_scheduled && !client->config->poll_mode) {
+        wiced_rtos_deregister_timed_event(&client->reconnect_event);
+        client->reconnect_scheduled = false;
+    }
+}
+
+static void record_puback_latency(IotconnectPublishStats *stats, uint32_t latency) {
+    if (0 == stats->acknowledged || latency < stats->min_latency_ms) {
+        stats->min_latency_ms = latency;
+    }
+    if (latency > stats->max_latency_ms) {
+        stats->max_latency_ms = latency;
+    }
+    stats->acknowledged++;
+    stats->total_latency_ms += latency;
+    int bucket = 0;
+    while (bucket < IOTC_SDK_PUBACK_LATENCY_NUM_BUCKETS - 1 && latency >= latency_buckets[bucket]) {
+        bucket++;
+    }
+    stats->latency_histogram[bucket]++;
+}
+
+static void release_inflight_entry(IotcMqttClient *client, InflightEntry *e) {
+    free(e->data);
+    memset(e, 0, sizeof(InflightEntry));
+    client->inflight_count--;
+}
+
+// Callbacks are invoked on copies, after inflight_mutex is released
+static void notify_failed(InflightEntry *entries, int num_entries, wiced_result_t result) {
+    for (int i = 0; i < num_entries; i++) {
+        if (entries[i].cb) {
+            entries[i].cb(result, 0, entries[i].ctx);
+        }
+    }
+}
+
+// True if a publish or a resend may still record a packet ID. Must be called with inflight_mutex held.
+static bool awaiting_msgid(IotcMqttClient *client) {
+    for (int i = 0; i < IOTC_SDK_MAX_INFLIGHT; i++) {
+        if (client->inflight[i].reserved || client->inflight[i].resending) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Consumes a PUBACK that arrived before its packet ID was recorded. Must be called with inflight_mutex held.
+static bool take_early_ack(IotcMqttClient *client, wiced_mqtt_msgid_t msgid) {
+    bool acked = false;
+    for (uint32_t i = 0; i < client->num_early_acks; i++) {
+        if (client->early_acks[i] == msgid) {
+            client->early_acks[i] = client->early_acks[--client->num_early_acks];
+            acked = true;
+            break;
+        }
+    }
+    if (!awaiting_msgid(client)) {
+        client->num_early_acks = 0; // leftovers are acks of messages that were given up on
+    }
+    return acked;
+}
+
+static void on_puback(IotcMqttClient *client, wiced_mqtt_msgid_t msgid) {
+    InflightEntry done;
+    bool found = false;
+    uint32_t latency = 0;
+    wiced_time_t now;
+    wiced_time_get_time(&now);
+
+    wiced_rtos_lock_mutex(&client->inflight_mutex);
+    for (int i = 0; i < IOTC_SDK_MAX_INFLIGHT; i++) {
+        InflightEntry *e = &client->inflight[i];
+        if (e->msgid == msgid && e->resending) {
+            e->acked = true; // completed once the resend returns, which still uses the data
+            wiced_rtos_unlock_mutex(&client->inflight_mutex);
+            return;
+        }
+        if (e->msgid == msgid) {
+            done = *e;
+            done.data = NULL; // freed below
+            latency = now - e->first_sent_at;
+            record_puback_latency(&client->publish_stats, latency);
+            release_inflight_entry(client, e);
+            found = true;
+            break;
+        }
+    }
+    if (!found && client->num_early_acks < IOTC_SDK_MAX_INFLIGHT && awaiting_msgid(client)) {
+        // may belong to a publish that has not recorded its packet ID yet
+        client->early_acks[client->num_early_acks++] = msgid;
+    }
+    wiced_rtos_unlock_mutex(&client->inflight_mutex);
+
+    if (found && done.cb) {
+        done.cb(WICED_SUCCESS, latency, done.ctx);
+    }
+}
+
+typedef struct {
+    IotconnectPublishCallback cb;
+    void *ctx;
+    wiced_result_t result;
+    uint32_t latency;
+} PublishOutcome;
+
+/*
+ * Publish the entries marked as resending and record their new packet IDs. inflight_mutex is not held while
+ * publishing, so that PUBACKs are not held back by a blocking send. The entries keep their data until then.
+ * An entry that can't be published is failed with fail_result, or kept for the next check with WICED_SUCCESS.
+ */
+static void resend_entries(IotcMqttClient *client, const int *indexes, int num_indexes, wiced_result_t fail_result) {
+    PublishOutcome outcomes[IOTC_SDK_MAX_INFLIGHT];
+    int num_outcomes = 0;
+
+    for (int i = 0; i < num_indexes; i++) {
+        InflightEntry *e = &client->inflight[indexes[i]];
+        wiced_mqtt_msgid_t msgid = mqtt_sdk_publish(client, WICED_MQTT_QOS_DELIVER_AT_LEAST_ONCE,
+                                                    publish_topic(client, e->flags), e->data, e->len);
+        wiced_time_t now;
+        wiced_time_get_time(&now);
+
+        wiced_rtos_lock_mutex(&client->inflight_mutex);
+        e->resending = false;
+        bool acked = e->acked || (msgid && take_early_ack(client, msgid));
+        if (acked || (!msgid && WICED_SUCCESS != fail_result)) {
+            PublishOutcome *o = &outcomes[num_outcomes++];
+            o->cb = e->cb;
+            o->ctx = e->ctx;
+            o->result = acked ? WICED_SUCCESS : fail_result;
+            o->latency = acked ? now - e->first_sent_at : 0;
+            if (acked) {
+                record_puback_latency(&client->publish_stats, o->latency);
+            } else {
+                client->publish_stats.failed++;
+            }
+            release_inflight_entry(client, e);
+        } else if (msgid) {
+            e->msgid = msgid;
+        } // else try again on the next timeout
+        wiced_rtos_unlock_mutex(&client->inflight_mutex);
+    }
+
+    for (int i = 0; i < num_outcomes; i++) {
+        if (outcomes[i].cb) {
+            outcomes[i].cb(outcomes[i].result, outcomes[i].latency, outcomes[i].ctx);
+        }
+    }
+}
+
+/*
+ * Retransmit messages that were not acknowledged in time, or give up on them once retransmits are exhausted.
+ * A retransmission is a new PUBLISH with a new packet ID, so the broker may receive duplicates (as QoS1 allows).
+ */
+static wiced_result_t check_inflight(void *arg) {
+    IotcMqttClient *client = (IotcMqttClient *) arg;
+    IotconnectMqttConfig *config = client->config;
+    InflightEntry failed[IOTC_SDK_MAX_INFLIGHT];
+    int num_failed = 0;
+    int resend[IOTC_SDK_MAX_INFLIGHT];
+    int num_resend = 0;
+    wiced_time_t now;
+
+    if (client->closing) {
+        return WICED_SUCCESS; // dispatched before destroy deregistered it
+    }
+    iotc_keepalive_tick(client->keepalive);
+    if (!client->is_connected) {
+        // messages are retransmitted after reconnecting
+        return WICED_SUCCESS;
+    }
+    wiced_time_get_time(&now);
+    wiced_rtos_lock_mutex(&client->inflight_mutex);
+    for (int i = 0; i < IOTC_SDK_MAX_INFLIGHT && client->inflight_count > 0; i++) {
+        InflightEntry *e = &client->inflight[i];
+        if (0 == e->msgid || e->resending || now - e->sent_at < config->puback_timeout_ms) {
+            continue;
+        }
+        if (e->data && e->retransmits < config->max_retransmits) {
+            e->retransmits++;
+            e->sent_at = now;
+            e->resending = true;
+            client->publish_stats.retransmits++;
+            resend[num_resend++] = i;
+            continue;
+        }
+        failed[num_failed] = *e;
+        failed[num_failed].data = NULL;
+        num_failed++;
+        client->publish_stats.failed++;
+        release_inflight_entry(client, e);
+    }
+    wiced_rtos_unlock_mutex(&client->inflight_mutex);
+
+    notify_failed(failed, num_failed, WICED_TIMEOUT);
+    resend_entries(client, resend, num_resend, WICED_SUCCESS);
+    return WICED_SUCCESS;
+}
+
+/*
+ * Send unacknowledged messages again after reconnecting. A clean session discards them on the broker side.
+ * With a persistent session they would be resent with the DUP flag and the same packet ID, but the WICED MQTT API
+ * assigns a new packet ID on every publish, so they are resent as new messages in both cases.
+ */
+static void retransmit_all_inflight(IotcMqttClient *client) {
+    InflightEntry failed[IOTC_SDK_MAX_INFLIGHT];
+    int num_failed = 0;
+    int resend[IOTC_SDK_MAX_INFLIGHT];
+    int num_resend = 0;
+    wiced_time_t now;
+    wiced_time_get_time(&now);
+
+    wiced_rtos_lock_mutex(&client->inflight_mutex);
+    for (int i = 0; i < IOTC_SDK_MAX_INFLIGHT; i++) {
+        InflightEntry *e = &client->inflight[i];
+        if (0 == e->msgid || e->resending) {
+            continue;
+        }
+        if (e->data) {
+            e->retransmits++;
+            e->sent_at = now;
+            e->resending = true;
+            client->publish_stats.retransmits++;
+            resend[num_resend++] = i;
+            continue;
+        }
+        failed[num_failed] = *e;
+        num_failed++;
+        client->publish_stats.failed++;
+        release_inflight_entry(client, e);
+    }
+    wiced_rtos_unlock_mutex(&client->inflight_mutex);
+
+    notify_failed(failed, num_failed, WICED_ERROR);
+    resend_entries(client, resend, num_resend, WICED_ERROR);
+}
+
+static void fail_all_inflight(IotcMqttClient *client) {
+    InflightEntry failed[IOTC_SDK_MAX_INFLIGHT];
+    int num_failed = 0;
+
+    wiced_rtos_lock_mutex(&client->inflight_mutex);
+    for (int i = 0; i < IOTC_SDK_MAX_INFLIGHT; i++) {
+        InflightEntry *e = &client->inflight[i];
+        if (e->msgid) {
+            failed[num_failed] = *e;
+            failed[num_failed].data = NULL;
+            num_failed++;
+            client->publish_stats.failed++;
+            release_inflight_entry(client, e);
+        }
+    }
+    wiced_rtos_unlock_mutex(&client->inflight_mutex);
+
+    notify_failed(failed, num_failed, WICED_ERROR);
+}
+
+static wiced_result_t worker_acquire(void) {
+    wiced_worker_thread_t *worker = iotc_worker_acquire();
+    if (!worker) {
+        return WICED_ERROR;
+    }
+    wiced_worker_thread_t *link = iotc_link_worker_acquire();
+    if (!link) {
+        iotc_worker_release();
+        return WICED_ERROR;
+    }
+    sdk_worker = worker;
+    link_worker = link;
+    return WICED_SUCCESS;
+}
+
+static void worker_release(void) {
+    iotc_link_worker_release();
+    iotc_worker_release();
+}
+
+static void stop_inflight_check(IotcMqttClient *client) {
+    if (client->inflight_check_registered) {
+        wiced_rtos_deregister_timed_event(&client->inflight_check_event);
+        client->inflight_check_registered = false;
+    }
+}
+
+/*
+ * Stop the timed events of the client and wait for the ones that are running or were dispatched already.
+ * On the worker itself nothing else is running. Events that are still queued there see closing and return.
+ */
+static void stop_events(IotcMqttClient *client) {
+    cancel_reconnect(client);
+    if (!client->config->poll_mode) {
+        stop_inflight_check(client);
+        iotc_worker_sync(sdk_worker);
+        iotc_worker_sync(link_worker);
+    }
+}
+
+static wiced_result_t free_client(void *arg) {
+    free(arg);
+    return WICED_SUCCESS;
+}
+
+/*
+ * Release the resources acquired by a partially successful iotc_wiced_mqtt_create.
+ */
+static void mqtt_create_cleanup(IotcMqttClient *client) {
+    cancel_reconnect(client);
+    if (!client->config->poll_mode) {
+        stop_inflight_check(client);
+        worker_release();
+    }
+    wiced_rtos_deinit_mutex(&client->inflight_mutex);
+    if (client->is_connected) {
+        wiced_mqtt_disconnect(client->mqtt_object);
+        client->is_connected = false;
+    }
+    wiced_mqtt_deinit(client->mqtt_object);
+    pending_deinit(client);
+    free(client);
+}
+
+wiced_result_t iotc_wiced_mqtt_create(IotcMqttClient **client_out, IotconnectMqttConfig *config,
+                                      wiced_mqtt_security_t *security) {
     wiced_result_t ret = WICED_SUCCESS;
+    IotcMqttClient *client;
 
-    if (_config == NULL) {
+    if (client_out == NULL || config == NULL) {
         WPRINT_LIB_INFO(("[MQTT]: Missing configuration\n"));
         return WICED_BADARG;
     }
-    config = _config;
+    *client_out = NULL;
 
     if (config->sr == NULL) {
         WPRINT_LIB_INFO(("[MQTT]: Missing sync response in config\n"));
@@ -249,105 +952,304 @@ iotc_wiced_mqtt_init(IotconnectMqttConfig *_config, wiced_mqtt_security_t *secur
     if (0 == config->mqtt_timeout_ms) {
         config->mqtt_timeout_ms = DEFAULT_MQTT_TIMEOUT_MS;
     }
+    if (0 == config->publish_window || config->publish_window > IOTC_SDK_MAX_INFLIGHT) {
+        config->publish_window = IOTC_SDK_MAX_INFLIGHT;
+    }
+    if (0 == config->puback_timeout_ms) {
+        config->puback_timeout_ms = config->mqtt_timeout_ms;
+    }
+    if (0 == config->max_retransmits) {
+        config->max_retransmits = DEFAULT_MAX_RETRANSMITS;
+    }
 
-    /* Memory allocated for mqtt object*/
-    mqtt_object = (wiced_mqtt_object_t) malloc(WICED_MQTT_OBJECT_MEMORY_SIZE_REQUIREMENT);
-    if (mqtt_object == NULL) {
+    /* Memory allocated for the client, including the mqtt object */
+    client = (IotcMqttClient *) calloc(1, sizeof(IotcMqttClient));
+    if (client == NULL) {
         WPRINT_LIB_INFO(("[MQTT]: Don't have memory to allocate for mqtt object...\n"));
         return WICED_OUT_OF_HEAP_SPACE;
     }
+    client->config = config;
+    client->mqtt_security = security;
+    client->keepalive = config->keepalive ? config->keepalive : &client->own_keepalive;
+    iotc_keepalive_configure(client->keepalive, config->keepalive_secs, config->keepalive_probe_max_secs);
 
-
-    ret = wiced_hostname_lookup(config->sr->broker.host, &broker_address, IOTC_SDK_RESOLVE_TIMEOUT_MS,
-                                WICED_STA_INTERFACE);
-    if (ret == WICED_ERROR || broker_address.ip.v4 == 0) {
-        WPRINT_LIB_INFO(("[MQTT] Error in resolving DNS\n"));
+    ret = resolve_broker(client);
+    if (WICED_SUCCESS != ret && !config->retry_connect) {
+        free(client);
         return ret;
     }
 
-    WPRINT_LIB_INFO(("[MQTT] Resolved Broker IP: %u.%u.%u.%u\n", (uint8_t)(GET_IPV4_ADDRESS(broker_address) >> 24),
-            (uint8_t)(GET_IPV4_ADDRESS(broker_address) >> 16),
-            (uint8_t)(GET_IPV4_ADDRESS(broker_address) >> 8),
-            (uint8_t)(GET_IPV4_ADDRESS(broker_address) >> 0)));
-
-    ret = wiced_mqtt_init(mqtt_object);
+    ret = wiced_mqtt_init(client->mqtt_object);
     if (ret != WICED_SUCCESS) {
         WPRINT_LIB_INFO(("[MQTT] Failed to init mqtt\n"));
+        free(client);
         return ret;
     }
 
-    wiced_rtos_init_semaphore(&semaphore);
+    pending_init(client);
 
-    ret = mqtt_conn_open(
-            config->sr->broker.client_id,
-            config->sr->broker.user_name,
-            config->sr->broker.pass,
-            IOTC_SDK_KEEPALIVE_INTERVAL_SECS,
-            mqtt_object,
-            &broker_address,
-            WICED_STA_INTERFACE,
-            mqtt_connection_event_cb,
-            security
-    );
+    if (!config->poll_mode) {
+        ret = worker_acquire();
+        if (WICED_SUCCESS != ret) {
+            wiced_mqtt_deinit(client->mqtt_object);
+            pending_deinit(client);
+            free(client);
+            return ret;
+        }
+    }
 
-    if (WICED_SUCCESS != ret) {
-        WPRINT_LIB_INFO(("[MQTT] Failed to initialize MQTT connection\n"));
-        return ret;
+    wiced_rtos_init_mutex(&client->inflight_mutex);
+    if (config->poll_mode || config->inflight_check_polled) {
+        wiced_time_get_time(&client->inflight_check_at);
+        client->inflight_check_at += IOTC_SDK_INFLIGHT_CHECK_INTERVAL_MS;
+    } else {
+        client->inflight_check_registered = WICED_SUCCESS == wiced_rtos_register_timed_event(
+                &client->inflight_check_event, link_worker, check_inflight, IOTC_SDK_INFLIGHT_CHECK_INTERVAL_MS,
+                client);
     }
 
-    ret = mqtt_sdk_subscribe(mqtt_object, config->sr->broker.sub_topic, WICED_MQTT_QOS_DELIVER_AT_LEAST_ONCE);
-    if (WICED_SUCCESS != ret) {
-        WPRINT_LIB_INFO(("[MQTT] Failed subscribe to devicebound messages\n"));
+    ret = client->broker_resolved ? mqtt_connect_and_subscribe(client) : WICED_ERROR;
+    if (WICED_SUCCESS != ret && !config->retry_connect) {
+        mqtt_create_cleanup(client);
         return ret;
     }
+    client->reconnect_enabled = true;
+    if (WICED_SUCCESS != ret) {
+        WPRINT_LIB_INFO(("[MQTT] Initial connection failed. Retrying...\n"));
+        wiced_time_get_time(&client->disconnected_at);
+        schedule_reconnect(client);
+        *client_out = client;
+        return WICED_SUCCESS;
+    }
 
     WPRINT_LIB_INFO(("[MQTT] Opening connection...\n"));
+    *client_out = client;
     return WICED_SUCCESS;
 }
 
 /*
- * Close a connection and wait for 5 seconds to receive a connection close OK event
+ * Close the connection and stop reconnecting. Doesn't wait for the broker.
  */
-void iotc_wiced_mqtt_disconnect() {
-    if (is_connected) {
-        if (wiced_mqtt_disconnect(mqtt_object) != WICED_SUCCESS) {
+void iotc_wiced_mqtt_disconnect(IotcMqttClient *client) {
+    if (!client) {
+        return;
+    }
+    cancel_reconnect(client);
+    if (client->is_connected) {
+        if (wiced_mqtt_disconnect(client->mqtt_object) != WICED_SUCCESS) {
             WPRINT_LIB_INFO(("[MQTT] Failed to disconnect\n"));
             return;
         }
     }
 }
 
-bool iotc_wiced_mqtt_is_connected() {
-    return is_connected;
+bool iotc_wiced_mqtt_is_connected(IotcMqttClient *client) {
+    return client && client->is_connected;
+}
+
+void iotc_wiced_mqtt_get_reconnect_stats(IotcMqttClient *client, IotconnectReconnectStats *stats) {
+    if (client && stats) {
+        *stats = client->reconnect_stats;
+    }
+}
+
+void iotc_wiced_mqtt_get_publish_stats(IotcMqttClient *client, IotconnectPublishStats *stats) {
+    if (client && stats) {
+        *stats = client->publish_stats;
+        stats->inflight = client->inflight_count;
+    }
 }
 
-wiced_result_t iotc_wiced_mqtt_publish(const uint8_t *data, size_t len) {
+static wiced_mqtt_msgid_t publish_qos0(IotcMqttClient *client, const uint8_t *data, size_t len, uint8_t flags,
+                                       IotconnectPublishCallback cb, void *ctx) {
+    wiced_mqtt_msgid_t ret = mqtt_sdk_publish(
+            client,
+            WICED_MQTT_QOS_DELIVER_AT_MOST_ONCE,
+            publish_topic(client, flags),
+            (uint8_t *) data,
+            len
+    );
+    if (ret) {
+        client->publish_stats.published_qos0++;
+        if (cb) {
+            cb(WICED_SUCCESS, 0, ctx);
+        }
+    }
+    return ret;
+}
+
+wiced_mqtt_msgid_t iotc_wiced_mqtt_publish(IotcMqttClient *client, const uint8_t *data, size_t len,
+                                           wiced_mqtt_qos_level_t qos, uint8_t flags,
+                                           IotconnectPublishCallback cb, void *ctx) {
     wiced_mqtt_msgid_t ret;
+    InflightEntry *e = NULL;
+    if (!client || !client->is_connected) {
+        return 0;
+    }
+    if (qos == WICED_MQTT_QOS_DELIVER_AT_MOST_ONCE) {
+        return publish_qos0(client, data, len, flags, cb, ctx);
+    }
+
+    // The slot is reserved under the lock, but the lock is not held while publishing, so that PUBACKs
+    // are not held back by a blocking send. A PUBACK that arrives before the packet ID is recorded is kept aside.
+    uint32_t window = client->config->publish_window;
+    if (!(flags & IOTC_PUBLISH_FLAG_PRIORITY) && window > IOTC_SDK_PRIORITY_INFLIGHT_RESERVE) {
+        window -= IOTC_SDK_PRIORITY_INFLIGHT_RESERVE;
+    }
+    wiced_rtos_lock_mutex(&client->inflight_mutex);
+    if (client->inflight_count >= window) {
+        client->publish_stats.window_full++;
+        wiced_rtos_unlock_mutex(&client->inflight_mutex);
+        return 0;
+    }
+    for (int i = 0; i < IOTC_SDK_MAX_INFLIGHT; i++) {
+        if (0 == client->inflight[i].msgid && !client->inflight[i].reserved) {
+            e = &client->inflight[i];
+            break;
+        }
+    }
+    e->reserved = true;
+    client->inflight_count++;
+    wiced_rtos_unlock_mutex(&client->inflight_mutex);
+
+    uint8_t *copy = NULL;
+    if (client->config->max_retransmits > 0) {
+        copy = malloc(len);
+        if (copy) {
+            memcpy(copy, data, len);
+        } // else the message just won't be retransmitted
+    }
+
     ret = mqtt_sdk_publish(
-            mqtt_object,
+            client,
             WICED_MQTT_QOS_DELIVER_AT_LEAST_ONCE,
-            config->sr->broker.pub_topic,
+            publish_topic(client, flags),
             (uint8_t *) data,
             len
     );
+    wiced_time_t now;
+    wiced_time_get_time(&now);
+    bool acked = false;
+
+    wiced_rtos_lock_mutex(&client->inflight_mutex);
+    e->reserved = false;
+    if (!ret) {
+        free(copy);
+        client->inflight_count--;
+        wiced_rtos_unlock_mutex(&client->inflight_mutex);
+        return 0;
+    }
+    client->publish_stats.published++;
+    acked = take_early_ack(client, ret);
+    if (acked) {
+        free(copy);
+        client->inflight_count--;
+        record_puback_latency(&client->publish_stats, 0); // acknowledged before the publish returned
+    } else {
+        e->msgid = ret;
+        e->retransmits = 0;
+        e->flags = flags;
+        e->first_sent_at = now;
+        e->sent_at = now;
+        e->data = copy;
+        e->len = len;
+        e->cb = cb;
+        e->ctx = ctx;
+    }
+    wiced_rtos_unlock_mutex(&client->inflight_mutex);
+
+    if (acked && cb) {
+        cb(WICED_SUCCESS, 0, ctx);
+    }
     return ret;
 }
 
-void iotc_wiced_mqtt_deinit() {
+// Returns the time left until t, or 0 if t has passed
+static uint32_t time_until(wiced_time_t now, wiced_time_t t) {
+    return (int32_t) (t - now) > 0 ? t - now : 0;
+}
+
+uint32_t iotc_wiced_mqtt_check_inflight(IotcMqttClient *client) {
+    wiced_time_t now;
+    if (!client || !(client->config->poll_mode || client->config->inflight_check_polled)) {
+        return UINT32_MAX;
+    }
+    if (client->retransmit_pending && client->is_connected) {
+        client->retransmit_pending = false;
+        retransmit_all_inflight(client);
+    }
+    wiced_time_get_time(&now);
+    if (0 == time_until(now, client->inflight_check_at)) {
+        client->inflight_check_at = now + IOTC_SDK_INFLIGHT_CHECK_INTERVAL_MS;
+        (void) check_inflight(client);
+    }
+    return time_until(now, client->inflight_check_at);
+}
+
+uint32_t iotc_wiced_mqtt_poll(IotcMqttClient *client) {
+    wiced_time_t now;
+    if (!client || !client->config->poll_mode) {
+        return UINT32_MAX;
+    }
+    (void) iotc_wiced_mqtt_check_inflight(client);
+    wiced_time_get_time(&now);
+    if (client->reconnect_scheduled && 0 == time_until(now, client->reconnect_at)) {
+        (void) reconnect_handler(client);
+        wiced_time_get_time(&now);
+    }
+    uint32_t next = time_until(now, client->inflight_check_at);
+    if (client->reconnect_scheduled && time_until(now, client->reconnect_at) < next) {
+        next = time_until(now, client->reconnect_at);
+    }
+    return next;
+}
+
+void iotc_wiced_mqtt_destroy(IotcMqttClient *client) {
+    IotconnectMqttConfig *config;
     wiced_result_t ret;
 
-    wiced_rtos_deinit_semaphore(&semaphore);
+    if (!client) {
+        return;
+    }
+    config = client->config;
+    client->closing = true;
+    stop_events(client);
 
-    ret = mqtt_sdk_unsubscribe(mqtt_object, config->sr->broker.sub_topic);
+    for (int i = 0; i < config->num_extra_sub_topics; i++) {
+        (void) mqtt_sdk_unsubscribe(client, config->extra_sub_topics[i]);
+    }
+    ret = mqtt_sdk_unsubscribe(client, config->sr->broker.sub_topic);
     if (WICED_SUCCESS != ret) {
         WPRINT_LIB_INFO(("[MQTT] Failed to unsubscribe from devicebound topic\n"));
-        return;
     }
-
-    ret = wiced_mqtt_deinit(mqtt_object);
+    if (client->is_connected) {
+        (void) wiced_mqtt_disconnect(client->mqtt_object);
+        client->is_connected = false;
+    }
+    // no more events from the MQTT thread after this, so the state they use can go
+    ret = wiced_mqtt_deinit(client->mqtt_object);
     if (WICED_SUCCESS != ret) {
         WPRINT_LIB_INFO(("[MQTT] Failed to deinitialize mqtt client\n"));
+    }
+    // a reconnect that was running during the first stop may have scheduled another attempt
+    stop_events(client);
+    fail_all_inflight(client);
+    wiced_rtos_deinit_mutex(&client->inflight_mutex);
+    pending_deinit(client);
+    if (config->poll_mode) {
+        free(client);
         return;
     }
-    config = NULL;
+    wiced_worker_thread_t *current = iotc_worker_is_current(sdk_worker) ? sdk_worker
+                                     : iotc_worker_is_current(link_worker) ? link_worker : NULL;
+    if (current) {
+        // events of this client that were dispatched before they were stopped are still queued behind this one
+        if (WICED_SUCCESS != wiced_rtos_send_asynchronous_event(current, free_client, client)) {
+            WPRINT_LIB_INFO(("[MQTT] Warning: Unable to schedule freeing the client. Leaking it\n"));
+        }
+    } else {
+        free(client);
+    }
+    // the worker can only go away after the events of this client were stopped
+    worker_release();
 }
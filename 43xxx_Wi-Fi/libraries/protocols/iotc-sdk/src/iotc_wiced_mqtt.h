@@ -9,31 +9,99 @@
 #include <mqtt_common.h>
 #include "iotc_sdk.h"
 #include "iotconnect_discovery.h"
+#include "iotc_topic_dispatch.h"
+#include "iotc_keepalive.h"
+
+// Size of the table that tracks QoS1 messages until they are acknowledged
+#ifndef IOTC_SDK_MAX_INFLIGHT
+#define IOTC_SDK_MAX_INFLIGHT 8
+#endif
+
+// Max CONNECT, SUBSCRIBE and UNSUBSCRIBE requests waiting for acknowledgement at the same time
+#ifndef IOTC_SDK_MAX_PENDING_REQUESTS
+#define IOTC_SDK_MAX_PENDING_REQUESTS (2 + IOTC_SDK_MAX_TOPIC_HANDLERS)
+#endif
+
+// In-flight slots that normal messages leave free for high priority ones, if the window is large enough
+#ifndef IOTC_SDK_PRIORITY_INFLIGHT_RESERVE
+#define IOTC_SDK_PRIORITY_INFLIGHT_RESERVE 1
+#endif
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// flags for iotc_wiced_mqtt_publish
+#define IOTC_PUBLISH_FLAG_COMPRESSED 0x01 // publish to compressed_pub_topic
+#define IOTC_PUBLISH_FLAG_PRIORITY 0x02 // may use the in-flight slots reserved for high priority messages
+
+// One broker connection with its own in-flight tracking and reconnect state.
+// Any number of clients can exist at the same time, for example one per child device of a gateway.
+typedef struct IotcMqttClient IotcMqttClient;
+
 typedef void (*IotconnectMqttOnDataCallback)(const uint8_t *data, size_t len, const uint8_t *topic,
-                                            const uint32_t topic_len);
+                                            const uint32_t topic_len, void *ctx);
+
+typedef void (*IotconnectMqttOnStatusCallback)(IotconnectConnectionStatus status, void *event_data, void *ctx);
 
-// This structure needs to be passed to iotc_wiced_mqtt_init and maintained in memory at all times during mqtt operation
+// This structure needs to be passed to iotc_wiced_mqtt_create and maintained in memory while the client exists
 typedef struct {
     IotclSyncResponse *sr;
     uint32_t mqtt_timeout_ms; // Timeout for most operations. 2x timeout for connect and subscribe.
+    uint32_t publish_window; // Max messages waiting for PUBACK. Capped at IOTC_SDK_MAX_INFLIGHT.
+    uint32_t puback_timeout_ms; // Retransmit if PUBACK is not received in this time. Default: mqtt_timeout_ms
+    int max_retransmits; // -1 disables retransmission and copying of in-flight messages
+    char **extra_sub_topics; // subscribed to in addition to the devicebound topic. Optional
+    int num_extra_sub_topics;
+    bool persistent_session; // connect with clean_session=0 and skip subscribing if the session is present
+    uint16_t keepalive_secs; // 0 for the default
+    uint16_t keepalive_probe_max_secs; // 0 disables probing
+    IotcKeepalive *keepalive; // zero-initialized state that outlives the client, so that a learned interval is kept
+    char *compressed_pub_topic; // pub_topic with the content encoding property. Needed for compressed messages
     IotconnectMqttOnDataCallback data_cb; // callback for mqtt inbound messages
-    IotConnectStatusCallback status_cb; // callback for nqtt status
+    IotconnectMqttOnStatusCallback status_cb; // callback for nqtt status
+    void *cb_ctx; // passed to data_cb and status_cb
+    bool poll_mode; // reconnects and retransmissions run from iotc_wiced_mqtt_poll instead of the worker thread
+    // retransmissions run from iotc_wiced_mqtt_check_inflight instead of the link worker, so that the thread that
+    // publishes can be the only one that does
+    bool inflight_check_polled;
+    bool retry_connect; // if the first connect fails, keep the client and retry it like a reconnect
 } IotconnectMqttConfig;
 
-wiced_result_t iotc_wiced_mqtt_init(IotconnectMqttConfig *_config, wiced_mqtt_security_t *security);
+// Creates a client and connects it. On success, *client must be released with iotc_wiced_mqtt_destroy.
+// With retry_connect, the client is returned even if it couldn't connect yet. Otherwise WICED_BADVALUE is returned
+// if the broker rejected the credentials or the client ID in CONNACK.
+// Clients share the SDK worker thread for reconnects, so the reconnects of many clients run one at a time, and
+// each one may block the next for up to 2x mqtt_timeout_ms. Their retransmissions and keepalive checks run
+// on a separate link worker thread, so they don't wait behind a reconnect.
+wiced_result_t iotc_wiced_mqtt_create(IotcMqttClient **client, IotconnectMqttConfig *config,
+                                      wiced_mqtt_security_t *security);
+
+// Publishes at QoS1 and tracks the message until PUBACK, or at QoS0 without tracking. cb is optional.
+// Returns 0 if not connected, if the in-flight window is full (QoS1 only) or if the publish fails.
+wiced_mqtt_msgid_t iotc_wiced_mqtt_publish(IotcMqttClient *client, const uint8_t *data, size_t len,
+                                           wiced_mqtt_qos_level_t qos, uint8_t flags,
+                                           IotconnectPublishCallback cb, void *ctx);
+
+void iotc_wiced_mqtt_disconnect(IotcMqttClient *client);
+
+bool iotc_wiced_mqtt_is_connected(IotcMqttClient *client);
+
+void iotc_wiced_mqtt_get_reconnect_stats(IotcMqttClient *client, IotconnectReconnectStats *stats);
 
-wiced_mqtt_msgid_t iotc_wiced_mqtt_publish(const uint8_t *data, size_t len);
+void iotc_wiced_mqtt_get_publish_stats(IotcMqttClient *client, IotconnectPublishStats *stats);
 
-void iotc_wiced_mqtt_disconnect();
+// For clients created with poll_mode or inflight_check_polled. Runs the retransmissions that are due,
+// including the ones after a reconnect, and the keepalive tick. Returns the time in ms until more are due.
+uint32_t iotc_wiced_mqtt_check_inflight(IotcMqttClient *client);
 
-bool iotc_wiced_mqtt_is_connected();
+// For clients created with poll_mode. Runs retransmissions and a reconnect attempt if they are due.
+// A reconnect attempt blocks for up to 2x mqtt_timeout_ms. Returns the time in ms until more work is due.
+uint32_t iotc_wiced_mqtt_poll(IotcMqttClient *client);
 
-void iotc_wiced_mqtt_deinit();
+// Unsubscribes, closes the connection and frees the client. Messages still in flight are failed.
+// Waits for a reconnect or retransmission of the client that is running on the worker.
+void iotc_wiced_mqtt_destroy(IotcMqttClient *client);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,111 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#include "iotc_worker.h"
+
+typedef struct {
+    wiced_worker_thread_t thread;
+    uint32_t num_refs;
+    uint8_t priority;
+    uint32_t stack_size;
+    uint32_t num_events;
+    const char *name; // for the log
+} IotcWorker;
+
+static IotcWorker sdk_worker = {
+        .priority = IOTC_SDK_WORKER_PRIORITY,
+        .stack_size = IOTC_SDK_WORKER_STACK_SIZE,
+        .num_events = IOTC_SDK_WORKER_EVENTS,
+        .name = "SDK"
+};
+
+static IotcWorker link_worker = {
+        .priority = IOTC_SDK_LINK_WORKER_PRIORITY,
+        .stack_size = IOTC_SDK_LINK_WORKER_STACK_SIZE,
+        .num_events = IOTC_SDK_LINK_WORKER_EVENTS,
+        .name = "link"
+};
+
+static wiced_worker_thread_t *acquire(IotcWorker *w) {
+    if (0 == w->num_refs) {
+        wiced_result_t ret = wiced_rtos_create_worker_thread(&w->thread, w->priority, w->stack_size, w->num_events);
+        if (WICED_SUCCESS != ret) {
+            WPRINT_LIB_INFO(("Error: Unable to create the %s worker thread\n", w->name));
+            return NULL;
+        }
+    }
+    w->num_refs++;
+    return &w->thread;
+}
+
+static void release(IotcWorker *w) {
+    if (0 == w->num_refs) {
+        return;
+    }
+    w->num_refs--;
+    if (0 == w->num_refs) {
+        wiced_rtos_delete_worker_thread(&w->thread);
+    }
+}
+
+wiced_worker_thread_t *iotc_worker_acquire(void) {
+    return acquire(&sdk_worker);
+}
+
+void iotc_worker_release(void) {
+    release(&sdk_worker);
+}
+
+wiced_worker_thread_t *iotc_link_worker_acquire(void) {
+    return acquire(&link_worker);
+}
+
+void iotc_link_worker_release(void) {
+    release(&link_worker);
+}
+
+typedef struct {
+    event_handler_t fn;
+    void *arg;
+    wiced_result_t result;
+    wiced_semaphore_t done;
+} RunRequest;
+
+static wiced_result_t run_request(void *arg) {
+    RunRequest *request = (RunRequest *) arg;
+    request->result = request->fn(request->arg);
+    wiced_rtos_set_semaphore(&request->done);
+    return WICED_SUCCESS;
+}
+
+bool iotc_worker_is_current(wiced_worker_thread_t *worker) {
+    return WICED_SUCCESS == wiced_rtos_is_current_thread(&worker->thread);
+}
+
+wiced_result_t iotc_worker_run(wiced_worker_thread_t *worker, event_handler_t fn, void *arg) {
+    if (iotc_worker_is_current(worker)) {
+        return fn(arg);
+    }
+    RunRequest request = {.fn = fn, .arg = arg, .result = WICED_ERROR};
+    wiced_rtos_init_semaphore(&request.done);
+    wiced_result_t ret = wiced_rtos_send_asynchronous_event(worker, run_request, &request);
+    if (WICED_SUCCESS == ret) {
+        wiced_rtos_get_semaphore(&request.done, WICED_NEVER_TIMEOUT);
+        ret = request.result;
+    } else {
+        WPRINT_LIB_INFO(("Error: Unable to send an event to the SDK worker thread\n"));
+    }
+    wiced_rtos_deinit_semaphore(&request.done);
+    return ret;
+}
+
+static wiced_result_t nothing(void *arg) {
+    (void) arg;
+    return WICED_SUCCESS;
+}
+
+void iotc_worker_sync(wiced_worker_thread_t *worker) {
+    (void) iotc_worker_run(worker, nothing, NULL);
+}
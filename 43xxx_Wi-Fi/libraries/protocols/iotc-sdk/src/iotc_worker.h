@@ -0,0 +1,71 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#pragma once
+
+#include <wiced.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The main worker thread of the SDK. Init, discovery, disconnect, inbound callbacks, queue drains, coalesced flushes,
+// link evaluation and the reconnects of all MQTT clients run on it, so that a single large stack serves all of them
+// and SDK state is only changed by one thread at a time.
+
+// Discovery and reconnects run TLS handshakes on this thread, so it needs a large stack
+#ifndef IOTC_SDK_WORKER_STACK_SIZE
+#define IOTC_SDK_WORKER_STACK_SIZE 8192
+#endif
+
+#ifndef IOTC_SDK_WORKER_PRIORITY
+#define IOTC_SDK_WORKER_PRIORITY WICED_DEFAULT_LIBRARY_PRIORITY
+#endif
+
+// Events that can be waiting at the same time: init steps, inbound processing, revalidation, queue drains,
+// the coalescer and link evaluation timers, calls that wait on the worker, and a reconnect of every MQTT client
+#ifndef IOTC_SDK_WORKER_EVENTS
+#define IOTC_SDK_WORKER_EVENTS 12
+#endif
+
+// The link worker runs the periodic in-flight checks of the MQTT clients: retransmissions and keepalive ticks.
+// They are short, and must not wait behind a reconnect that blocks the SDK worker in a TLS handshake.
+#ifndef IOTC_SDK_LINK_WORKER_STACK_SIZE
+#define IOTC_SDK_LINK_WORKER_STACK_SIZE 4096
+#endif
+
+#ifndef IOTC_SDK_LINK_WORKER_PRIORITY
+#define IOTC_SDK_LINK_WORKER_PRIORITY WICED_DEFAULT_LIBRARY_PRIORITY
+#endif
+
+// One in-flight check per MQTT client can be waiting
+#ifndef IOTC_SDK_LINK_WORKER_EVENTS
+#define IOTC_SDK_LINK_WORKER_EVENTS 8
+#endif
+
+// Creates the thread on the first call. Every successful call must be matched with iotc_worker_release.
+wiced_worker_thread_t *iotc_worker_acquire(void);
+
+// Deletes the thread with the last reference, which therefore must not be released on the worker itself.
+// Timed events on it must be deregistered before.
+void iotc_worker_release(void);
+
+// Same as iotc_worker_acquire and iotc_worker_release, for the link worker
+wiced_worker_thread_t *iotc_link_worker_acquire(void);
+
+void iotc_link_worker_release(void);
+
+// Runs fn on the worker and waits for it to return, so that it doesn't overlap with other work on the worker.
+// Calls fn directly when called on the worker itself. Must not be called from anything the worker waits for.
+wiced_result_t iotc_worker_run(wiced_worker_thread_t *worker, event_handler_t fn, void *arg);
+
+// Waits until the events that were sent to the worker before this call have run. Returns right away on the worker.
+void iotc_worker_sync(wiced_worker_thread_t *worker);
+
+bool iotc_worker_is_current(wiced_worker_thread_t *worker);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,40 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#pragma once
+
+// The sync response of iotc-c-lib
+
+#include "iotconnect_lib.h"
+
+typedef enum {
+    IOTCL_SR_OK = 0,
+    IOTCL_SR_DEVICE_NOT_REGISTERED,
+    IOTCL_SR_AUTO_REGISTER,
+    IOTCL_SR_DEVICE_NOT_FOUND,
+    IOTCL_SR_DEVICE_INACTIVE,
+    IOTCL_SR_DEVICE_MOVED,
+    IOTCL_SR_CPID_NOT_FOUND,
+    IOTCL_SR_UNKNOWN_DEVICE_STATUS = 20,
+    IOTCL_SR_ALLOCATION_ERROR,
+    IOTCL_SR_PARSING_ERROR
+} IotclSyncResult;
+
+typedef struct {
+    IotclSyncResult ds;
+    char *cpid;
+    char *dtg;
+    int ee;
+    int rc;
+    int at;
+    struct {
+        char *host;
+        char *client_id;
+        char *user_name;
+        char *pass;
+        char *sub_topic;
+        char *pub_topic;
+    } broker;
+} IotclSyncResponse;
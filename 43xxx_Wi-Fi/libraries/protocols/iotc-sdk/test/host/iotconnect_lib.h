@@ -0,0 +1,49 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#pragma once
+
+// The iotc-c-lib types that iotc_sdk.h refers to
+
+#include <stdbool.h>
+
+typedef void *IotclEventData;
+typedef void *IotclMessageHandle;
+
+typedef enum {
+    UNKNOWN_EVENT = 0,
+    DEVICE_COMMAND,
+    DEVICE_OTA,
+    ON_FORCE_SYNC = 0x12,
+    ON_CLOSE = 0x13
+} IotConnectEventType;
+
+typedef void (*IotclOtaCallback)(IotclEventData data);
+
+typedef void (*IotclCommandCallback)(IotclEventData data);
+
+typedef void (*IotclMessageCallback)(IotclEventData data, IotConnectEventType type);
+
+typedef struct {
+    char *env;
+    char *cpid;
+    char *duid;
+} IotclDeviceConfig;
+
+typedef struct {
+    const char *dtg;
+} IotclTelemetryConfig;
+
+typedef struct {
+    IotclMessageCallback msg_cb;
+    IotclOtaCallback ota_cb;
+    IotclCommandCallback cmd_cb;
+} IotclEventFunctions;
+
+typedef struct {
+    IotclDeviceConfig device;
+    IotclTelemetryConfig telemetry;
+    IotclEventFunctions event_functions;
+} IotclConfig;
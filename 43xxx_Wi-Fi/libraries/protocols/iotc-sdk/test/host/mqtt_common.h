@@ -0,0 +1,25 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#pragma once
+
+// The WICED MQTT types that iotc_sdk.h refers to
+
+#include "wiced.h"
+
+typedef enum {
+    WICED_MQTT_QOS_DELIVER_AT_MOST_ONCE = 0,
+    WICED_MQTT_QOS_DELIVER_AT_LEAST_ONCE = 1,
+    WICED_MQTT_QOS_DELIVER_EXACTLY_ONCE = 2
+} wiced_mqtt_qos_level_t;
+
+typedef struct {
+    char *ca_cert;
+    uint32_t ca_cert_len;
+    char *cert;
+    uint32_t cert_len;
+    char *key;
+    uint32_t key_len;
+} wiced_mqtt_security_t;
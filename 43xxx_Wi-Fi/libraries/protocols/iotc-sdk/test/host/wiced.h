@@ -0,0 +1,100 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#pragma once
+
+// The subset of the WICED API used by the SDK modules that are built on a host for tests.
+// RTOS calls are implemented over pthreads in wiced_host.c.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    WICED_SUCCESS = 0,
+    WICED_PENDING,
+    WICED_TIMEOUT,
+    WICED_PARTIAL_RESULTS,
+    WICED_ERROR,
+    WICED_BADARG,
+    WICED_BADOPTION,
+    WICED_UNSUPPORTED,
+    WICED_OUT_OF_HEAP_SPACE,
+    WICED_NOTUP,
+    WICED_UNFINISHED,
+    WICED_WOULD_BLOCK,
+    WICED_BADVALUE
+} wiced_result_t;
+
+#define WPRINT_LIB_INFO(args) printf args
+#define WPRINT_LIB_ERROR(args) printf args
+
+#define WICED_NEVER_TIMEOUT 0xFFFFFFFF
+#define WICED_NO_WAIT 0
+#define WICED_DEFAULT_LIBRARY_PRIORITY 5
+
+typedef uint32_t wiced_time_t; // ms
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint32_t count;
+} wiced_semaphore_t;
+
+typedef struct {
+    pthread_mutex_t mutex;
+} wiced_mutex_t;
+
+typedef uint32_t wiced_thread_arg_t;
+typedef void (*wiced_thread_function_t)(wiced_thread_arg_t arg);
+
+typedef struct {
+    pthread_t thread;
+    wiced_thread_function_t function;
+    wiced_thread_arg_t arg;
+} wiced_thread_t;
+
+wiced_result_t wiced_time_get_time(wiced_time_t *time_ptr);
+
+wiced_result_t wiced_rtos_delay_milliseconds(uint32_t ms);
+
+void wiced_init_nanosecond_clock(void);
+
+uint64_t wiced_get_nanosecond_clock_value(void);
+
+wiced_result_t wiced_rtos_init_semaphore(wiced_semaphore_t *semaphore);
+
+wiced_result_t wiced_rtos_set_semaphore(wiced_semaphore_t *semaphore);
+
+wiced_result_t wiced_rtos_get_semaphore(wiced_semaphore_t *semaphore, uint32_t timeout_ms);
+
+wiced_result_t wiced_rtos_deinit_semaphore(wiced_semaphore_t *semaphore);
+
+wiced_result_t wiced_rtos_init_mutex(wiced_mutex_t *mutex);
+
+wiced_result_t wiced_rtos_lock_mutex(wiced_mutex_t *mutex);
+
+wiced_result_t wiced_rtos_unlock_mutex(wiced_mutex_t *mutex);
+
+wiced_result_t wiced_rtos_deinit_mutex(wiced_mutex_t *mutex);
+
+// Priority and stack size are ignored
+wiced_result_t wiced_rtos_create_thread(wiced_thread_t *thread, uint8_t priority, const char *name,
+                                        wiced_thread_function_t function, uint32_t stack_size, void *arg);
+
+wiced_result_t wiced_rtos_thread_join(wiced_thread_t *thread);
+
+// The thread must have exited. Threads are only freed by a join.
+wiced_result_t wiced_rtos_delete_thread(wiced_thread_t *thread);
+
+#ifdef __cplusplus
+}
+#endif
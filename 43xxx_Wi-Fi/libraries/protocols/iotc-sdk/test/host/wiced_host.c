@@ -0,0 +1,133 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#include <time.h>
+#include <errno.h>
+#include "wiced.h"
+
+wiced_result_t wiced_time_get_time(wiced_time_t *time_ptr) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    *time_ptr = (wiced_time_t) (ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+    return WICED_SUCCESS;
+}
+
+void wiced_init_nanosecond_clock(void) {
+}
+
+uint64_t wiced_get_nanosecond_clock_value(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+wiced_result_t wiced_rtos_delay_milliseconds(uint32_t ms) {
+    struct timespec ts = {.tv_sec = ms / 1000, .tv_nsec = (long) (ms % 1000) * 1000000};
+    while (0 != nanosleep(&ts, &ts) && EINTR == errno) {
+    }
+    return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_rtos_init_semaphore(wiced_semaphore_t *semaphore) {
+    pthread_mutex_init(&semaphore->mutex, NULL);
+    pthread_cond_init(&semaphore->cond, NULL);
+    semaphore->count = 0;
+    return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_rtos_set_semaphore(wiced_semaphore_t *semaphore) {
+    pthread_mutex_lock(&semaphore->mutex);
+    semaphore->count++;
+    pthread_cond_signal(&semaphore->cond);
+    pthread_mutex_unlock(&semaphore->mutex);
+    return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_rtos_get_semaphore(wiced_semaphore_t *semaphore, uint32_t timeout_ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long) (timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    wiced_result_t ret = WICED_SUCCESS;
+    pthread_mutex_lock(&semaphore->mutex);
+    while (0 == semaphore->count) {
+        int err = (WICED_NEVER_TIMEOUT == timeout_ms) ?
+                  pthread_cond_wait(&semaphore->cond, &semaphore->mutex) :
+                  pthread_cond_timedwait(&semaphore->cond, &semaphore->mutex, &deadline);
+        if (ETIMEDOUT == err) {
+            ret = WICED_TIMEOUT;
+            break;
+        }
+    }
+    if (WICED_SUCCESS == ret) {
+        semaphore->count--;
+    }
+    pthread_mutex_unlock(&semaphore->mutex);
+    return ret;
+}
+
+wiced_result_t wiced_rtos_deinit_semaphore(wiced_semaphore_t *semaphore) {
+    pthread_cond_destroy(&semaphore->cond);
+    pthread_mutex_destroy(&semaphore->mutex);
+    return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_rtos_init_mutex(wiced_mutex_t *mutex) {
+    pthread_mutexattr_t attr;
+    // WICED mutexes are recursive
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&mutex->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_rtos_lock_mutex(wiced_mutex_t *mutex) {
+    pthread_mutex_lock(&mutex->mutex);
+    return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_rtos_unlock_mutex(wiced_mutex_t *mutex) {
+    pthread_mutex_unlock(&mutex->mutex);
+    return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_rtos_deinit_mutex(wiced_mutex_t *mutex) {
+    pthread_mutex_destroy(&mutex->mutex);
+    return WICED_SUCCESS;
+}
+
+static void *thread_main(void *arg) {
+    wiced_thread_t *thread = (wiced_thread_t *) arg;
+    thread->function(thread->arg);
+    return NULL;
+}
+
+wiced_result_t wiced_rtos_create_thread(wiced_thread_t *thread, uint8_t priority, const char *name,
+                                        wiced_thread_function_t function, uint32_t stack_size, void *arg) {
+    (void) priority;
+    (void) name;
+    (void) stack_size;
+    thread->function = function;
+    thread->arg = (wiced_thread_arg_t) (uintptr_t) arg;
+    if (0 != pthread_create(&thread->thread, NULL, thread_main, thread)) {
+        return WICED_ERROR;
+    }
+    return WICED_SUCCESS;
+}
+
+wiced_result_t wiced_rtos_thread_join(wiced_thread_t *thread) {
+    return 0 == pthread_join(thread->thread, NULL) ? WICED_SUCCESS : WICED_ERROR;
+}
+
+wiced_result_t wiced_rtos_delete_thread(wiced_thread_t *thread) {
+    (void) thread;
+    return WICED_SUCCESS;
+}
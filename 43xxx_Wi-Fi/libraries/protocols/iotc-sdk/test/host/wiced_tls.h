@@ -0,0 +1,18 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+#pragma once
+
+// The fields of the WICED TLS session that iotc_tls_session.c uses
+
+#include "wiced.h"
+
+typedef struct {
+    wiced_time_t start;
+    int32_t ciphersuite;
+    int32_t length;
+    uint8_t id[32];
+    uint8_t master[48];
+} wiced_tls_session_t;
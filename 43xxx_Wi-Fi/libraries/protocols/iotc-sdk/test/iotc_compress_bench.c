@@ -0,0 +1,178 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+// Compression benchmark over a corpus of typical payloads: single telemetry records, coalesced batches,
+// an ack and incompressible data. Files given on the command line are added to the corpus.
+// Reports the ratio and the cost per message from the SDK's own stats, and verifies that every
+// compressed payload decompresses back to the original.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "iotc_compress.h"
+
+#define MAX_PAYLOAD_SIZE 65535
+#define MIN_BENCH_NS 50000000ull // per payload
+#define MAX_FILES 16
+
+typedef struct {
+    const char *name;
+    uint8_t *data;
+    size_t len;
+} Payload;
+
+static const char *record_template =
+        "{\"id\":\"avnet-demo-%04d\",\"dt\":\"2021-01-18T10:%02d:%02d.000Z\","
+        "\"d\":{\"version\":\"01.00.00\",\"cpu\":%d,\"temperature\":%d.%d,\"humidity\":%d}}";
+
+// A telemetry message with num_records records, the shape that coalescing produces
+static Payload make_telemetry(const char *name, int num_records) {
+    Payload p = {.name = name, .data = malloc(MAX_PAYLOAD_SIZE), .len = 0};
+    p.len += sprintf((char *) p.data,
+                     "{\"cpId\":\"AVNETDEMOCPID\",\"dtg\":\"0a1b2c3d-0000-1111-2222-333344445555\",\"mt\":0,"
+                     "\"sdk\":{\"l\":\"M_C\",\"v\":\"2.0\",\"e\":\"avnetpoc\"},\"d\":[");
+    for (int i = 0; i < num_records; i++) {
+        p.len += sprintf((char *) &p.data[p.len], "%s", i ? "," : "");
+        p.len += sprintf((char *) &p.data[p.len], record_template, i % 8, i / 60 % 60, i % 60,
+                         20 + i % 13, 21 + i % 5, i % 10, 40 + i % 17);
+    }
+    p.len += sprintf((char *) &p.data[p.len], "]}");
+    return p;
+}
+
+static Payload make_ack(void) {
+    Payload p = {.name = "command ack", .data = malloc(MAX_PAYLOAD_SIZE), .len = 0};
+    p.len = sprintf((char *) p.data,
+                    "{\"d\":{\"ackId\":\"6b4c2b63-8d9e-4f0a-b1c2-d3e4f5a6b7c8\",\"st\":6,\"msg\":\"Command executed\","
+                    "\"cmdId\":\"set-led\"},\"mt\":5,\"t\":\"2021-01-18T10:00:00.000Z\",\"sid\":\"AVNETDEMOCPID\"}");
+    return p;
+}
+
+static Payload make_random(size_t len) {
+    Payload p = {.name = "random bytes", .data = malloc(len), .len = len};
+    uint32_t x = 2463534242u;
+    for (size_t i = 0; i < len; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        p.data[i] = (uint8_t) x;
+    }
+    return p;
+}
+
+static Payload load_file(const char *path) {
+    Payload p = {.name = path, .data = malloc(MAX_PAYLOAD_SIZE), .len = 0};
+    FILE *f = fopen(path, "rb");
+    if (f) {
+        p.len = fread(p.data, 1, MAX_PAYLOAD_SIZE, f);
+        fclose(f);
+    }
+    return p;
+}
+
+// liblzf compatible decompression, for verification only
+static size_t lzf_decompress(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len) {
+    size_t ip = 0;
+    size_t op = 0;
+    while (ip < in_len) {
+        uint32_t ctrl = in[ip++];
+        if (ctrl < (1 << 5)) {
+            size_t len = ctrl + 1;
+            if (op + len > out_len || ip + len > in_len) {
+                return 0;
+            }
+            memcpy(&out[op], &in[ip], len);
+            op += len;
+            ip += len;
+            continue;
+        }
+        size_t len = ctrl >> 5;
+        if (7 == len) {
+            if (ip >= in_len) {
+                return 0;
+            }
+            len += in[ip++];
+        }
+        if (ip >= in_len) {
+            return 0;
+        }
+        size_t back = ((ctrl & 0x1f) << 8) + in[ip++] + 1;
+        len += 2;
+        if (back > op || op + len > out_len) {
+            return 0;
+        }
+        for (size_t i = 0; i < len; i++, op++) {
+            out[op] = out[op - back]; // may overlap
+        }
+    }
+    return op;
+}
+
+// Returns false if the payload doesn't survive a round trip
+static bool bench(const Payload *p) {
+    static uint8_t restored[MAX_PAYLOAD_SIZE];
+    IotconnectCompressionStats before;
+    IotconnectCompressionStats after;
+    size_t compressed_len = 0;
+    uint64_t elapsed = 0;
+    uint32_t iterations = 0;
+    bool ok = true;
+
+    iotc_compress_get_stats(&before);
+    uint64_t start = wiced_get_nanosecond_clock_value();
+    while (elapsed < MIN_BENCH_NS) {
+        uint8_t *out = iotc_compress(p->data, p->len, &compressed_len);
+        if (0 == iterations && out) {
+            ok = (p->len == lzf_decompress(out, compressed_len, restored, sizeof(restored))
+                  && 0 == memcmp(restored, p->data, p->len));
+        }
+        if (!out) {
+            compressed_len = p->len; // sent as is
+        }
+        free(out);
+        iterations++;
+        elapsed = wiced_get_nanosecond_clock_value() - start;
+    }
+    iotc_compress_get_stats(&after);
+
+    uint32_t attempts = after.attempts - before.attempts;
+    double us_per_message = (double) (after.total_time_us - before.total_time_us) / attempts;
+    printf("%-24s %6lu -> %6lu bytes  %5.1f%%  %8.2f us/msg  %7.1f MB/s  %s\n",
+           p->name, (unsigned long) p->len, (unsigned long) compressed_len,
+           100.0 * (double) compressed_len / (double) p->len, us_per_message,
+           us_per_message > 0 ? (double) p->len / us_per_message : 0.0,
+           ok ? "" : "ROUND TRIP FAILED");
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    Payload corpus[6 + MAX_FILES];
+    int num_payloads = 0;
+    int failures = 0;
+
+    if (WICED_SUCCESS != iotc_compress_init(1)) {
+        printf("FAIL: iotc_compress_init\n");
+        return 1;
+    }
+    corpus[num_payloads++] = make_ack();
+    corpus[num_payloads++] = make_telemetry("telemetry x1", 1);
+    corpus[num_payloads++] = make_telemetry("telemetry x4", 4);
+    corpus[num_payloads++] = make_telemetry("telemetry x16", 16);
+    corpus[num_payloads++] = make_telemetry("telemetry x64", 64);
+    corpus[num_payloads++] = make_random(1024);
+    for (int i = 1; i < argc && i <= MAX_FILES; i++) {
+        corpus[num_payloads++] = load_file(argv[i]);
+    }
+
+    for (int i = 0; i < num_payloads; i++) {
+        if (0 == corpus[i].len) {
+            printf("%-24s skipped: empty or unreadable\n", corpus[i].name);
+            continue;
+        }
+        failures += bench(&corpus[i]) ? 0 : 1;
+        free(corpus[i].data);
+    }
+    return failures ? 1 : 0;
+}
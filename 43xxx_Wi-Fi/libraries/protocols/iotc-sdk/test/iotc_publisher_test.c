@@ -0,0 +1,153 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+// Stress test of the publisher ring: many producers against the writer thread.
+// Checks that every message arrives exactly once, in order per producer, on a single thread,
+// and that the counters agree with what the producers and the handler saw.
+// The Makefile builds the publisher with a yield between reading and claiming a slot, and the producers start
+// together, so that they collide even on a single core.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include "iotc_publisher.h"
+
+#define NUM_PRODUCERS 8
+#define MESSAGES_PER_PRODUCER 100000
+#define NUM_SLOTS 64
+#define SLOT_SIZE 16 // fits a TestMessage
+#define TOTAL_MESSAGES ((uint32_t) NUM_PRODUCERS * MESSAGES_PER_PRODUCER)
+
+typedef struct {
+    uint32_t producer;
+    uint32_t seq; // 1-based, per producer
+} TestMessage;
+
+static uint32_t last_seq[NUM_PRODUCERS]; // writer only
+static volatile uint32_t num_received = 0;
+static uint32_t num_out_of_order = 0;
+static uint32_t num_bad_records = 0;
+static uint32_t num_rejected[NUM_PRODUCERS];
+static pthread_t writer;
+static bool writer_seen = false;
+static uint32_t num_other_threads = 0;
+static pthread_barrier_t start;
+static uint8_t large_received[100];
+static size_t large_len = 0;
+
+static void handle(const IotcPublishRecord *record) {
+    if (!writer_seen) {
+        writer = pthread_self();
+        writer_seen = true;
+    } else if (!pthread_equal(writer, pthread_self())) {
+        num_other_threads++;
+    }
+
+    TestMessage m;
+    if (record->len != sizeof(m) || record->has_options) {
+        num_bad_records++;
+        return;
+    }
+    memcpy(&m, record->data, sizeof(m));
+    if (m.producer >= NUM_PRODUCERS || m.seq != last_seq[m.producer] + 1) {
+        num_out_of_order++;
+    }
+    if (m.producer < NUM_PRODUCERS) {
+        last_seq[m.producer] = m.seq;
+    }
+    __sync_fetch_and_add(&num_received, 1);
+}
+
+static void handle_large(const IotcPublishRecord *record) {
+    large_len = record->len;
+    memcpy(large_received, record->data, record->len <= sizeof(large_received) ? record->len : 0);
+}
+
+static void *produce(void *arg) {
+    TestMessage m = {.producer = (uint32_t) (uintptr_t) arg};
+    pthread_barrier_wait(&start);
+    for (m.seq = 1; m.seq <= MESSAGES_PER_PRODUCER; m.seq++) {
+        // a full ring is reported and retried, like an application would
+        while (WICED_SUCCESS != iotc_publisher_push((const uint8_t *) &m, sizeof(m), NULL)) {
+            num_rejected[m.producer]++;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static int check(bool ok, const char *what) {
+    printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+    return ok ? 0 : 1;
+}
+
+int main(void) {
+    pthread_t producers[NUM_PRODUCERS];
+    int failures = 0;
+
+    if (WICED_SUCCESS != iotc_publisher_init(NUM_SLOTS, SLOT_SIZE, true, handle, NULL)) {
+        printf("FAIL: iotc_publisher_init\n");
+        return 1;
+    }
+    pthread_barrier_init(&start, NULL, NUM_PRODUCERS);
+    for (uint32_t i = 0; i < NUM_PRODUCERS; i++) {
+        pthread_create(&producers[i], NULL, produce, (void *) (uintptr_t) i);
+    }
+    for (uint32_t i = 0; i < NUM_PRODUCERS; i++) {
+        pthread_join(producers[i], NULL);
+    }
+    // the writer may still be working through the ring
+    for (int i = 0; i < 5000 && num_received < TOTAL_MESSAGES; i++) {
+        wiced_rtos_delay_milliseconds(1);
+    }
+
+    IotconnectPublisherStats stats;
+    iotc_publisher_get_stats(&stats);
+    uint32_t rejected = 0;
+    for (uint32_t i = 0; i < NUM_PRODUCERS; i++) {
+        rejected += num_rejected[i];
+    }
+    printf("received %u of %u, enqueued %u, processed %u, rejected %u, contended %u, max depth %u\n",
+           (unsigned) num_received, (unsigned) TOTAL_MESSAGES, (unsigned) stats.enqueued,
+           (unsigned) stats.processed, (unsigned) stats.rejected, (unsigned) stats.contended,
+           (unsigned) stats.max_depth);
+
+    failures += check(num_received == TOTAL_MESSAGES, "every message was handled");
+    failures += check(0 == num_bad_records, "records arrive intact and without options");
+    failures += check(0 == num_out_of_order, "messages of each producer arrive in order, without gaps");
+    bool all_last = true;
+    for (uint32_t i = 0; i < NUM_PRODUCERS; i++) {
+        all_last = all_last && last_seq[i] == MESSAGES_PER_PRODUCER;
+    }
+    failures += check(all_last, "the last message of each producer arrived");
+    failures += check(0 == num_other_threads, "the handler only runs on the writer thread");
+    failures += check(stats.enqueued == TOTAL_MESSAGES, "enqueued counts every accepted push");
+    failures += check(stats.processed == TOTAL_MESSAGES, "processed counts every handled message");
+    failures += check(stats.rejected == rejected, "rejected counts every push that found the ring full");
+    failures += check(0 == stats.depth && iotc_publisher_is_empty(), "the ring is empty afterwards");
+    failures += check(stats.max_depth > 0 && stats.max_depth <= NUM_SLOTS, "max depth is within the ring size");
+    failures += check(stats.contended > 0, "producers competed for slots");
+
+    iotc_publisher_deinit();
+    failures += check(!iotc_publisher_is_enabled(), "deinit stops the writer and frees the ring");
+    failures += check(WICED_NOTUP == iotc_publisher_push((const uint8_t *) "x", 1, NULL),
+                      "pushes are refused after deinit");
+
+    // a message larger than the slot goes through the heap
+    uint8_t large[sizeof(large_received)];
+    for (size_t i = 0; i < sizeof(large); i++) {
+        large[i] = (uint8_t) i;
+    }
+    bool large_ok = WICED_SUCCESS == iotc_publisher_init(NUM_SLOTS, SLOT_SIZE, false, handle_large, NULL)
+                    && WICED_SUCCESS == iotc_publisher_push(large, sizeof(large), NULL)
+                    && 1 == iotc_publisher_process(UINT32_MAX);
+    failures += check(large_ok && large_len == sizeof(large) && 0 == memcmp(large, large_received, sizeof(large)),
+                      "a message larger than the slot arrives intact");
+    iotc_publisher_deinit();
+    pthread_barrier_destroy(&start);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,202 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+// Tests of the sync response cache against file-backed storage: a round trip, and entries that must be
+// rejected because of their magic, version, checksum, expiry or device. Also tests the fallback to discovery
+// when the broker rejects the cached entry.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "iotc_sr_cache.h"
+#include "iotc_sr_arena.h"
+
+#define STORAGE_SIZE 512
+#define STORAGE_FILE "build/sr_cache_storage.bin"
+
+// IotcSrCacheHeader: magic, version, data_len, expires_at, checksum
+#define MAGIC_OFFSET 0
+#define VERSION_OFFSET 4
+#define HEADER_SIZE 16
+
+#define CPID "testcpid"
+#define ENV "testenv"
+#define DUID "testduid"
+
+static wiced_result_t file_read(void *ctx, uint32_t offset, void *data, uint32_t len) {
+    FILE *f = (FILE *) ctx;
+    if (0 != fseek(f, offset, SEEK_SET) || len != fread(data, 1, len, f)) {
+        return WICED_ERROR;
+    }
+    return WICED_SUCCESS;
+}
+
+static wiced_result_t file_write(void *ctx, uint32_t offset, const void *data, uint32_t len) {
+    FILE *f = (FILE *) ctx;
+    if (0 != fseek(f, offset, SEEK_SET) || len != fwrite(data, 1, len, f) || 0 != fflush(f)) {
+        return WICED_ERROR;
+    }
+    return WICED_SUCCESS;
+}
+
+static IotconnectNvStorage storage = {.read = file_read, .write = file_write, .size = STORAGE_SIZE};
+
+static IotclSyncResponse sample = {
+        .ds = IOTCL_SR_OK,
+        .cpid = CPID,
+        .dtg = "0a1b2c3d-0000-1111-2222-333344445555",
+        .broker = {
+                .host = "broker.example.com",
+                .client_id = CPID "-" DUID,
+                .user_name = NULL, // null fields must survive as well
+                .pass = "secret",
+                .sub_topic = "devices/" CPID "-" DUID "/messages/devicebound/#",
+                .pub_topic = "devices/" CPID "-" DUID "/messages/events/"
+        }
+};
+
+static bool str_equal(const char *a, const char *b) {
+    return (!a && !b) || (a && b && 0 == strcmp(a, b));
+}
+
+static bool sr_equal(const IotclSyncResponse *a, const IotclSyncResponse *b) {
+    return str_equal(a->cpid, b->cpid)
+           && str_equal(a->dtg, b->dtg)
+           && str_equal(a->broker.host, b->broker.host)
+           && str_equal(a->broker.client_id, b->broker.client_id)
+           && str_equal(a->broker.user_name, b->broker.user_name)
+           && str_equal(a->broker.pass, b->broker.pass)
+           && str_equal(a->broker.sub_topic, b->broker.sub_topic)
+           && str_equal(a->broker.pub_topic, b->broker.pub_topic);
+}
+
+static void flip_byte(uint32_t offset) {
+    uint8_t b;
+    file_read(storage.ctx, offset, &b, 1);
+    b ^= 0x5A;
+    file_write(storage.ctx, offset, &b, 1);
+}
+
+static bool store(uint32_t ttl_secs) {
+    return WICED_SUCCESS == iotc_sr_cache_store(&storage, CPID, ENV, DUID, &sample, ttl_secs);
+}
+
+// True if a load for the test device succeeds
+static bool loads(bool accept_expired) {
+    IotclSyncResponse *sr = iotc_sr_cache_load(&storage, CPID, ENV, DUID, accept_expired);
+    iotc_sr_arena_free(sr);
+    return NULL != sr;
+}
+
+// Fake connection and discovery for iotc_sr_cache_connect
+typedef struct {
+    wiced_result_t results[2]; // of the first connect and of the ones after it
+    int num_connects;
+    int num_discoveries;
+    const IotclSyncResponse *discovered; // NULL if discovery fails
+} FakeLink;
+
+static wiced_result_t fake_connect(void *ctx) {
+    FakeLink *link = (FakeLink *) ctx;
+    return link->results[link->num_connects++ == 0 ? 0 : 1];
+}
+
+static const IotclSyncResponse *fake_discover(void *ctx) {
+    FakeLink *link = (FakeLink *) ctx;
+    link->num_discoveries++;
+    return link->discovered;
+}
+
+static wiced_result_t cache_connect(FakeLink *link) {
+    return iotc_sr_cache_connect(&storage, CPID, ENV, DUID, 3600, fake_connect, fake_discover, link);
+}
+
+// True if the cache holds the expected sync response
+static bool holds(const IotclSyncResponse *expected) {
+    IotclSyncResponse *sr = iotc_sr_cache_load(&storage, CPID, ENV, DUID, false);
+    bool ret = sr && sr_equal(sr, expected);
+    iotc_sr_arena_free(sr);
+    return ret;
+}
+
+static int check(bool ok, const char *what) {
+    printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+    return ok ? 0 : 1;
+}
+
+int main(void) {
+    int failures = 0;
+    FILE *f = fopen(STORAGE_FILE, "w+b");
+    if (!f) {
+        printf("FAIL: unable to create %s\n", STORAGE_FILE);
+        return 1;
+    }
+    static const uint8_t zeros[STORAGE_SIZE];
+    fwrite(zeros, 1, sizeof(zeros), f);
+    storage.ctx = f;
+
+    failures += check(!loads(true), "empty storage is rejected");
+
+    failures += check(store(3600), "an entry is stored");
+    IotclSyncResponse *sr = iotc_sr_cache_load(&storage, CPID, ENV, DUID, false);
+    failures += check(sr && sr_equal(sr, &sample), "the entry loads with every field intact");
+    failures += check(sr && IOTCL_SR_OK == sr->ds, "the loaded entry is a successful sync response");
+    iotc_sr_arena_free(sr);
+
+    sr = iotc_sr_cache_load(&storage, CPID, ENV, "otherduid", true);
+    failures += check(!sr, "an entry of another device is rejected");
+    iotc_sr_arena_free(sr);
+
+    flip_byte(MAGIC_OFFSET);
+    failures += check(!loads(true), "a magic mismatch is rejected");
+
+    store(3600);
+    flip_byte(VERSION_OFFSET);
+    failures += check(!loads(true), "a version mismatch is rejected");
+
+    store(3600);
+    flip_byte(HEADER_SIZE + 4);
+    failures += check(!loads(true), "a checksum mismatch is rejected");
+
+    store(0);
+    failures += check(!loads(false), "an expired entry is rejected");
+    failures += check(loads(true), "an expired entry is accepted for revalidation");
+
+    store(3600);
+    iotc_sr_cache_invalidate(&storage);
+    failures += check(!loads(true), "an invalidated entry is rejected");
+
+    IotconnectNvStorage small = storage;
+    small.size = HEADER_SIZE + 32;
+    failures += check(WICED_SUCCESS != iotc_sr_cache_store(&small, CPID, ENV, DUID, &sample, 3600),
+                      "an entry that doesn't fit the storage is not stored");
+
+    IotclSyncResponse fresh = sample;
+    fresh.broker.pass = "rotated";
+
+    store(3600);
+    FakeLink link = {.results = {WICED_SUCCESS}};
+    failures += check(WICED_SUCCESS == cache_connect(&link) && 1 == link.num_connects && 0 == link.num_discoveries,
+                      "a connection with the cached entry doesn't run discovery");
+
+    link = (FakeLink) {.results = {WICED_ERROR}, .discovered = &fresh};
+    failures += check(WICED_ERROR == cache_connect(&link) && 1 == link.num_connects && 0 == link.num_discoveries,
+                      "a connection failure doesn't run discovery");
+    failures += check(holds(&sample), "a connection failure keeps the cached entry");
+
+    link = (FakeLink) {.results = {WICED_BADVALUE, WICED_SUCCESS}, .discovered = &fresh};
+    failures += check(WICED_SUCCESS == cache_connect(&link) && 2 == link.num_connects && 1 == link.num_discoveries,
+                      "a rejection runs discovery and connects again");
+    failures += check(holds(&fresh), "the discovered sync response replaces the rejected entry");
+
+    link = (FakeLink) {.results = {WICED_BADVALUE, WICED_SUCCESS}, .discovered = NULL};
+    failures += check(WICED_SUCCESS != cache_connect(&link) && 1 == link.num_connects && 1 == link.num_discoveries,
+                      "a rejection fails if discovery fails");
+    failures += check(!loads(true), "the rejected entry is invalidated even if discovery fails");
+
+    fclose(f);
+    remove(STORAGE_FILE);
+    return failures ? 1 : 0;
+}
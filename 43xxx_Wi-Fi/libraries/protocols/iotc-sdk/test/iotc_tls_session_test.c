@@ -0,0 +1,179 @@
+//
+// Copyright: Avnet 2021
+// Created by Nikola Markovic <nikola.markovic@avnet.com> on 1/18/2021.
+//
+
+// Tests of the TLS session cache against file-backed storage: sessions are saved and restored across a reboot,
+// invalidated, evicted, and handshakes are counted as full or abbreviated.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "iotc_tls_session.h"
+
+#define STORAGE_SIZE 1024
+#define STORAGE_FILE "build/tls_session_storage.bin"
+
+#define DISCOVERY_HOST "discovery.iotconnect.io"
+#define AGENT_HOST "agent.iotconnect.io"
+
+static wiced_result_t file_read(void *ctx, uint32_t offset, void *data, uint32_t len) {
+    FILE *f = (FILE *) ctx;
+    if (0 != fseek(f, offset, SEEK_SET) || len != fread(data, 1, len, f)) {
+        return WICED_ERROR;
+    }
+    return WICED_SUCCESS;
+}
+
+static wiced_result_t file_write(void *ctx, uint32_t offset, const void *data, uint32_t len) {
+    FILE *f = (FILE *) ctx;
+    if (0 != fseek(f, offset, SEEK_SET) || len != fwrite(data, 1, len, f) || 0 != fflush(f)) {
+        return WICED_ERROR;
+    }
+    return WICED_SUCCESS;
+}
+
+static IotconnectNvStorage storage = {.read = file_read, .write = file_write, .size = STORAGE_SIZE};
+
+// A session as the server would negotiate it, with the ID and the master secret derived from seed
+static wiced_tls_session_t make_session(uint8_t seed) {
+    wiced_tls_session_t session;
+    memset(&session, 0, sizeof(session));
+    session.ciphersuite = 0xC02B;
+    session.length = sizeof(session.id);
+    memset(session.id, seed, sizeof(session.id));
+    memset(session.master, seed ^ 0xFF, sizeof(session.master));
+    return session;
+}
+
+static bool session_equal(const wiced_tls_session_t *a, const wiced_tls_session_t *b) {
+    return a->ciphersuite == b->ciphersuite
+           && a->length == b->length
+           && 0 == memcmp(a->id, b->id, sizeof(a->id))
+           && 0 == memcmp(a->master, b->master, sizeof(a->master));
+}
+
+// True if the cache offers the expected session for host. NULL expects no session.
+static bool offers(const char *host, const wiced_tls_session_t *expected) {
+    wiced_tls_session_t session;
+    memset(&session, 0xA5, sizeof(session)); // prepare must clear what it doesn't fill
+    iotc_tls_session_prepare(host, &session);
+    if (!expected) {
+        return 0 == session.length;
+    }
+    return session_equal(&session, expected);
+}
+
+// Saves the session as the result of a handshake and returns the handshake counts that it added
+static IotconnectTlsStats handshake(const char *host, const wiced_tls_session_t *session) {
+    IotconnectTlsStats before, after;
+    iotc_tls_session_get_stats(&before);
+    iotc_tls_session_save(host, session);
+    iotc_tls_session_get_stats(&after);
+    after.full_handshakes -= before.full_handshakes;
+    after.abbreviated_handshakes -= before.abbreviated_handshakes;
+    return after;
+}
+
+static bool is_full(IotconnectTlsStats s) {
+    return 1 == s.full_handshakes && 0 == s.abbreviated_handshakes;
+}
+
+static bool is_abbreviated(IotconnectTlsStats s) {
+    return 0 == s.full_handshakes && 1 == s.abbreviated_handshakes;
+}
+
+static void flip_byte(uint32_t offset) {
+    uint8_t b;
+    file_read(storage.ctx, offset, &b, 1);
+    b ^= 0x5A;
+    file_write(storage.ctx, offset, &b, 1);
+}
+
+static int check(bool ok, const char *what) {
+    printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+    return ok ? 0 : 1;
+}
+
+int main(void) {
+    int failures = 0;
+    FILE *f = fopen(STORAGE_FILE, "w+b");
+    if (!f) {
+        printf("FAIL: unable to create %s\n", STORAGE_FILE);
+        return 1;
+    }
+    static const uint8_t zeros[STORAGE_SIZE];
+    fwrite(zeros, 1, sizeof(zeros), f);
+    storage.ctx = f;
+
+    wiced_tls_session_t first = make_session(1);
+    wiced_tls_session_t second = make_session(2);
+
+    iotc_tls_session_init(&storage);
+    failures += check(offers(DISCOVERY_HOST, NULL), "empty storage offers no session");
+
+    failures += check(is_full(handshake(DISCOVERY_HOST, &first)), "a new session counts as a full handshake");
+    failures += check(offers(DISCOVERY_HOST, &first), "the saved session is offered for its host");
+    failures += check(offers(AGENT_HOST, NULL), "the session is not offered for another host");
+
+    failures += check(is_abbreviated(handshake(DISCOVERY_HOST, &first)),
+                      "a session that the server kept counts as an abbreviated handshake");
+
+    iotc_tls_session_init(&storage); // reboot
+    failures += check(offers(DISCOVERY_HOST, &first), "the session is restored from storage");
+    failures += check(is_abbreviated(handshake(DISCOVERY_HOST, &first)),
+                      "a restored session resumes with an abbreviated handshake");
+
+    failures += check(is_full(handshake(DISCOVERY_HOST, &second)),
+                      "a session that the server replaced counts as a full handshake");
+    iotc_tls_session_init(&storage);
+    failures += check(offers(DISCOVERY_HOST, &second), "the replacement session is persisted");
+
+    wiced_tls_session_t other_master = second;
+    other_master.master[0] ^= 1;
+    failures += check(is_full(handshake(DISCOVERY_HOST, &other_master)),
+                      "a session with the same ID but another master secret counts as a full handshake");
+
+    iotc_tls_session_invalidate(DISCOVERY_HOST);
+    failures += check(offers(DISCOVERY_HOST, NULL), "an invalidated session is not offered");
+    iotc_tls_session_init(&storage);
+    failures += check(offers(DISCOVERY_HOST, NULL), "the invalidation is persisted");
+
+    handshake(DISCOVERY_HOST, &first);
+    wiced_tls_session_t no_resumption = first;
+    no_resumption.length = 0;
+    failures += check(is_full(handshake(DISCOVERY_HOST, &no_resumption)) && offers(DISCOVERY_HOST, NULL),
+                      "a server without resumption support invalidates the session");
+
+    // one more host than the cache holds evicts the least recently used one
+    char hosts[IOTC_SDK_TLS_SESSION_CACHE_SIZE + 1][32];
+    for (int i = 0; i <= IOTC_SDK_TLS_SESSION_CACHE_SIZE; i++) {
+        wiced_tls_session_t session = make_session((uint8_t) (10 + i));
+        sprintf(hosts[i], "host%d.example.com", i);
+        handshake(hosts[i], &session);
+    }
+    failures += check(offers(hosts[0], NULL), "the least recently used session is evicted");
+    bool all_kept = true;
+    for (int i = 1; i <= IOTC_SDK_TLS_SESSION_CACHE_SIZE; i++) {
+        wiced_tls_session_t session = make_session((uint8_t) (10 + i));
+        all_kept = all_kept && offers(hosts[i], &session);
+    }
+    failures += check(all_kept, "the more recently used sessions are kept");
+
+    handshake(DISCOVERY_HOST, &first);
+    flip_byte(16); // in the first entry, covered by the checksum
+    iotc_tls_session_init(&storage);
+    failures += check(offers(DISCOVERY_HOST, NULL), "corrupted storage is ignored");
+
+    IotconnectNvStorage small = storage;
+    small.size = 16;
+    iotc_tls_session_init(&small);
+    handshake(AGENT_HOST, &first);
+    failures += check(offers(AGENT_HOST, &first), "sessions are cached in RAM when the storage is too small");
+    iotc_tls_session_init(&storage);
+    failures += check(offers(AGENT_HOST, NULL), "storage that is too small is not written to");
+
+    fclose(f);
+    remove(STORAGE_FILE);
+    return failures ? 1 : 0;
+}